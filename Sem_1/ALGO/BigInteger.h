@@ -16,73 +16,270 @@
 #include <ostream>
 #include <istream>
 #include <ios>
-#include <stack>
 #include <vector>
 #include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <memory>
 
 /**
  * BigInteger is a class representing arbitrarily large integer numbers.
  *
- * The representation is as follows - we store the bits of the number in the array. Each bit is in a single array cell.
- * Also the least significant bit is the first in the array and so on. The number 10 in decimal equals 1010 in binary
- * and is represented as |0|1|0|1|. The negative numbers are stored using twos complement. The flag positive tells us if
- * the number is positive or zero (stored directly) or negative (and thus stored using the twos complement).
+ * The representation is as follows - we store the number in base 2^64, every array cell (a limb) holds 64 bits of the
+ * number. The least significant limb is the first in the array and so on. The number 2^64 + 10 is represented as
+ * |10|1|. The limbs hold the absolute value of the number and the flag positive tells us if the number is positive
+ * or zero, or negative. So -(2^64 + 10) is |10|1| with the flag cleared, negating a number just flips the flag and the
+ * additions and comparisons work on the absolute values directly. Zero has no limbs and it is always positive.
+ *
+ * The bit operations (getLength, shiftRight, testBit, intValue) still behave as if the number was in the twos
+ * complement - shiftRight rounds down and getLength of a negative x is the bit length of -x - 1.
  *
  * The operations are implemented in an update fashion. For example adding means adding the given argument to `this`.
  * A simple advantage is a smaller memory consumption and less memory operations. However conventional operators are
- * provided.
+ * provided. The product a * b is not computed by the operator, it gives an expression which is evaluated when it is
+ * assigned - so a * b % m, c + a * b and c - a * b are computed by the fused operations mulMod, addMul and subMul.
  */
+struct DivisionResult;
+struct ProductExpression;
+struct ProductModExpression;
+struct SumProductExpression;
+
 class BigInteger {
+    friend class MontgomeryContext;
+    friend void divideAndMod(const BigInteger & a, const BigInteger & b, DivisionResult & res);
+
 public:
     /**
-     * Creates the big decimal from an integer value.
+     * A single digit of the number - one machine word.
      */
-    BigInteger(int value = 0):
-        digits(new char [sizeof(value) * 8]),
-        positive(true),
-        length(sizeof(value) * 8) {
-        // If the value is negative make it positive, we will change the signs at the end.
-        bool valuePositive = value >= 0;
-        if (!valuePositive) {
-            value = -value;
+    typedef std::uint64_t Limb;
+
+    /**
+     * Twice as wide as a limb, holds a full product of two limbs (GCC/Clang extension).
+     */
+    typedef unsigned __int128 DoubleLimb;
+
+    /**
+     * Number of bits in a limb.
+     */
+    static const unsigned LIMB_BITS = 64;
+
+    /**
+     * Number of limbs stored directly in the object, numbers up to 256 bits never touch the heap.
+     */
+    static const std::size_t INLINE_LIMBS = 4;
+
+    /**
+     * Counters of the limb arrays the numbers asked for - the ones served from the inline storage and the ones
+     * allocated on the heap.
+     */
+    struct AllocationCounter {
+        std::size_t inlineBuffers;
+        std::size_t heapBuffers;
+    };
+
+    /**
+     * The allocation counter of the calling thread, it can be reset between measurements. Every thread has its own,
+     * so counting needs no synchronization.
+     */
+    static AllocationCounter & allocationCounter() {
+        static thread_local AllocationCounter counter = {0, 0};
+        return counter;
+    }
+
+    /**
+     * Source of the limb arrays which do not fit into the inline storage - the counterpart of std::pmr::memory_resource
+     * for C++11. deallocate gets the same n the array was allocated with.
+     *
+     * Every number keeps the resource it was created with (a moved number the resource of the original) and returns
+     * its arrays there. The resource is the one set for the thread by setResource at the creation, by default the
+     * thread-local pool.
+     */
+    class MemoryResource {
+    public:
+        virtual ~MemoryResource() {
+        }
+
+        virtual Limb * allocate(std::size_t n) = 0;
+
+        virtual void deallocate(Limb * array, std::size_t n) = 0;
+    };
+
+    /**
+     * Sets the resource of the numbers created by the calling thread from now on, 0 is the thread-local pool. Returns
+     * the previous one.
+     */
+    static MemoryResource * setResource(MemoryResource * resource) {
+        MemoryResource * previous = currentResource();
+        currentResource() = resource;
+        return previous;
+    }
+
+    /**
+     * Monotonic arena for one computation - for example one powerMod or one extendedEuclid call.
+     *
+     * While the arena exists, it is the resource of the numbers the thread creates. The arrays are cut one after
+     * another from large chunks and they are not freed one by one (except the last one, which is just cut off again).
+     * The destructor frees all the chunks at once and restores the previous resource. So the numbers created in the
+     * scope of the arena must not outlive it, the results have to go into numbers created before it. Arenas of one
+     * thread must be destroyed in the reverse order of their creation.
+     */
+    class Arena : public MemoryResource {
+    public:
+        explicit Arena(std::size_t chunkLimbs = 1 << 16):
+            chunkLimbs(chunkLimbs),
+            top(0),
+            end(0),
+            previous(setResource(this)) {
+        }
+
+        ~Arena() {
+            setResource(previous);
+            for (std::size_t i = 0; i < chunks.size(); ++i) {
+                delete [] chunks[i];
+            }
         }
 
-        // Copy the digits.
-        for (size_t i = 0; i < length; ++i) {
-            digits[i] = value % 2;
-            value /= 2;
+        Limb * allocate(std::size_t n) {
+            if ((std::size_t) (end - top) < n) {
+                std::size_t size = std::max(chunkLimbs, n);
+                chunks.push_back(new Limb [size]);
+                top = chunks.back();
+                end = top + size;
+            }
+            Limb * array = top;
+            top += n;
+            return array;
         }
 
-        // Change the sign if necessary.
-        if (!valuePositive) {
-            negate();
+        void deallocate(Limb * array, std::size_t n) {
+            if (array + n == top) {
+                top = array;
+            }
         }
 
+    private:
+        Arena(const Arena &);
+        Arena & operator=(const Arena &);
+
+        std::size_t chunkLimbs;
+        std::vector<Limb *> chunks;
+        Limb * top;
+        Limb * end;
+        MemoryResource * previous;
+    };
+
+    /**
+     * Operand lengths (in limbs) from which the faster algorithms take over.
+     */
+    struct Thresholds {
+        /**
+         * Karatsuba multiplication is used if both operands have at least this many limbs.
+         */
+        std::size_t karatsuba;
+
+        /**
+         * Toom-Cook 3-way multiplication is used if both operands have at least this many limbs. Its extra additions
+         * and the exact division by 3 pay off late: testMultiply measured the crossover with Karatsuba at about
+         * 384 limbs (24576 bits), below that Toom-3 was up to 1.6 times slower.
+         */
+        std::size_t toom3;
+
+        /**
+         * Multiplication by the number-theoretic transform is used if both operands have at least this many limbs.
+         */
+        std::size_t ntt;
+
+        /**
+         * Division of Burnikel and Ziegler is used if both the divisor and the quotient have at least this many limbs.
+         */
+        std::size_t burnikelZiegler;
+
+        /**
+         * Conversion to a radix splits the number by a power of the radix if it has at least this many limbs, smaller
+         * numbers are converted by repeated divisions by a single limb. Parsing splits the digits the same way.
+         */
+        std::size_t radixConversion;
+
+        /**
+         * The conversion to a radix converts the two halves of a number in parallel threads if the number has at
+         * least this many limbs.
+         */
+        std::size_t parallelConversion;
+    };
+
+    /**
+     * The global thresholds, they can be changed to tune the algorithms for a machine.
+     */
+    static Thresholds & thresholds() {
+        static Thresholds t = {32, 384, 8192, 80, 20, 16384};
+        return t;
+    }
+
+    /**
+     * Creates the big decimal from an integer value.
+     */
+    BigInteger(int value = 0):
+        resource(currentResource()),
+        digits(allocate(1)),
+        positive(value >= 0),
+        length(1),
+        capacity(INLINE_LIMBS) {
+        // The absolute value, computed in the limb type so that even the smallest int is fine.
+        digits[0] = positive ? (Limb) value : (Limb) 0 - (Limb) (long long) value;
+
         // Normalize the number.
         normalize();
     }
 
     /**
-     * Creates the BigInteger from a given string.
+     * Creates the BigInteger from a given string - an optional minus sign and the digits 0-9, a-z (or A-Z) of the
+     * radix (2 to 36). Throws an exception if the string is not a valid number.
      */
     explicit BigInteger(std::string value, std::size_t radix = 10):
-        digits(0),
+        resource(currentResource()),
+        digits(inlineDigits),
         positive(true),
-        length(0) {
+        length(0),
+        capacity(INLINE_LIMBS) {
+        if (radix < 2 || radix > 36) {
+            throw std::runtime_error("The radix must be between 2 and 36.");
+        }
+
         // Skip the sign if necessary.
         size_t start = (value.size() > 0 && value[0] == '-') ? 1 : 0;
+        if (start == value.size()) {
+            throw std::runtime_error("\"" + value + "\" is not a number.");
+        }
 
-        // Conversion from a given radix.
-        BigInteger t(0);
-        for (std::size_t i = start; i < value.size(); ++i) {
-            t.multiply(radix);
-            if (std::isdigit(value[i])) {
-                t.add(value[i] - '0');
-            } else {
-                t.add(value[i] - 'a' + 10);
+        // The digits are taken in chunks fitting into a limb, counted from the least significant one - so only the
+        // first chunk can be shorter.
+        std::size_t chunkDigits;
+        chunkRadix(radix, chunkDigits);
+        std::size_t count = value.size() - start;
+        std::vector<Limb> chunks((count + chunkDigits - 1) / chunkDigits);
+        std::size_t i = start;
+        for (std::size_t c = 0; c < chunks.size(); ++c) {
+            std::size_t end = value.size() - (chunks.size() - 1 - c) * chunkDigits;
+            Limb v = 0;
+            for (; i < end; ++i) {
+                v = v * radix + digitValue(value, i, radix);
             }
+            chunks[c] = v;
         }
 
+        // Conversion from a given radix.
+        BigInteger t = fromChunks(chunks.data(), chunks.size(), radix);
+
         // The sign.
         if (start == 1) {
             t.negate();
@@ -92,13 +289,22 @@ public:
         swap(t);
     }
 
+    /**
+     * Evaluation of the expressions given by the operators - a * b, a * b % m, c + a * b and c - a * b.
+     */
+    BigInteger(ProductExpression && e);
+    BigInteger(ProductModExpression && e);
+    BigInteger(SumProductExpression && e);
+
     /**
      * Move constructor - technical C++ stuff.
      */
     BigInteger(BigInteger && b):
-        digits(0),
+        resource(b.resource),
+        digits(inlineDigits),
         positive(true),
-        length(0) {
+        length(0),
+        capacity(INLINE_LIMBS) {
         swap(b);
     }
 
@@ -110,18 +316,12 @@ public:
     static BigInteger random(const BigInteger & max, bool allowZero = true) {
         BigInteger t(0);
 
-        // Set the bit length.
-        t.setBitLength(max.length);
         do {
             // Generate random bits.
-            for (std::size_t i = 0; i < max.length; ++i) {
-                t.digits[i] = rand() % 2;
-            }
+            t.randomBits(max.getLength());
             // Allow only the allowed max => t >(=) 0.
-        } while (t.compare(max) > 0 || (!allowZero && t.compare(0) == 0));
+        } while (t.compare(max) > 0 || (!allowZero && t.isZero()));
 
-        // Normalize.
-        t.normalize();
         return t;
     }
 
@@ -131,18 +331,12 @@ public:
     static BigInteger random(const BigInteger& min, const BigInteger& max) {
         BigInteger t(0);
 
-        // Set the bit length.
-        t.setBitLength(max.length);
         do {
             // Generate random bits.
-            for (std::size_t i = 0; i < max.length; ++i) {
-                t.digits[i] = rand() % 2;
-            }
+            t.randomBits(max.getLength());
             // Allow only the allowed min <= t <= max.
         } while (t.compare(min) < 0 || t.compare(max) > 0);
 
-        // Normalize.
-        t.normalize();
         return t;
     }
 
@@ -155,24 +349,17 @@ public:
     static BigInteger randomBitL(const size_t bits, bool allowZero = true, bool allowMsbZero = true) {
         BigInteger t(0);
 
-        // Set the bit length.
-        t.setBitLength(bits);
         do {
-            if(allowMsbZero) {
-                t.digits[bits-1] = rand() % 2;
-            } else {
-                // Set MSB = 1 to guarantee the bit length for normalized t
-                t.digits[bits-1] = 1;
-            }
             // Generate random bits.
-            for (std::size_t i = 0; i < bits-1; ++i) {
-                t.digits[i] = rand() % 2;
+            t.randomBits(bits);
+            if(!allowMsbZero && bits > 0) {
+                // Set MSB = 1 to guarantee the bit length for normalized t
+                t.setLength((bits + LIMB_BITS - 1) / LIMB_BITS);
+                t.digits[(bits - 1) / LIMB_BITS] |= (Limb) 1 << ((bits - 1) % LIMB_BITS);
             }
             // Allow only the allowed max > t >(=) 0.
-        } while (!allowZero && t.compare(0) == 0);
+        } while (!allowZero && t.isZero());
 
-        // Normalize.
-        t.normalize();
         return t;
     }
 
@@ -189,7 +376,7 @@ public:
      * Destructor.
      */
     ~BigInteger(void) {
-        delete [] digits;
+        release(digits, capacity);
         digits = 0;
         length = 0;
         positive = true;
@@ -199,28 +386,61 @@ public:
      * Copy constructor.
      */
     BigInteger(const BigInteger & a):
-        digits(new char [a.length]),
+        resource(currentResource()),
+        digits(allocate(a.length)),
         positive(a.positive),
-        length(a.length) {
-        for (std::size_t i = 0; i < length; ++i) {
-            digits[i] = a.digits[i];
-        }
+        length(a.length),
+        capacity(std::max(a.length, (std::size_t) INLINE_LIMBS)) {
+        std::copy(a.digits, a.digits + length, digits);
     }
 
     /**
      * Assignment operator.
      */
     BigInteger & operator=(const BigInteger & a) {
-        BigInteger b(a);
-        b.swap(*this);
+        if (this == &a) {
+            return *this;
+        }
+
+        // The limb array is kept if it is large enough, otherwise a new one is taken without copying the old limbs.
+        if (a.length > capacity) {
+            reallocate(a.length, 0);
+        }
+        length = a.length;
+        std::copy(a.digits, a.digits + length, digits);
+        positive = a.positive;
         return *this;
     }
 
+    /**
+     * Move assignment - the numbers are swapped, the old value leaves with a.
+     */
+    BigInteger & operator=(BigInteger && a) {
+        return swap(a);
+    }
+
+    /**
+     * Assignment of the expressions, they are evaluated directly into this number.
+     */
+    BigInteger & operator=(ProductExpression && e);
+    BigInteger & operator=(ProductModExpression && e);
+    BigInteger & operator=(SumProductExpression && e);
+
     /**
      * Bit length retrieval.
+     *
+     * For negative numbers it is the bit length without the leading ones of the twos complement, which is the bit
+     * length of the absolute value minus one. It is one less for the powers of two, -2^k needs k bits and the sign.
      */
     std::size_t getLength() const {
-        return length;
+        if (length == 0) {
+            return 0;
+        }
+        std::size_t bits = (length - 1) * LIMB_BITS + limbBitLength(digits[length - 1]);
+        if (!positive && lowestBit() == bits - 1) {
+            --bits;
+        }
+        return bits;
     }
 
     /**
@@ -236,114 +456,72 @@ public:
     BigInteger& swap(BigInteger & a) {
         using std::swap;
 
-        swap(a.digits, this->digits);
+        if (this == &a) {
+            return *this;
+        }
+
+        // The arrays of different resources can not change their owners, the values are copied.
+        if (this->resource != a.resource && (this->digits != this->inlineDigits || a.digits != a.inlineDigits)) {
+            BigInteger t(a);
+            a = *this;
+            return *this = t;
+        }
+
+        // Heap arrays are just exchanged, the inline ones have to be copied.
+        bool thisInline = this->digits == this->inlineDigits;
+        bool aInline = a.digits == a.inlineDigits;
+        if (thisInline && aInline) {
+            std::swap_ranges(this->inlineDigits, this->inlineDigits + INLINE_LIMBS, a.inlineDigits);
+        } else if (thisInline) {
+            std::copy(this->inlineDigits, this->inlineDigits + this->length, a.inlineDigits);
+            this->digits = a.digits;
+            a.digits = a.inlineDigits;
+        } else if (aInline) {
+            std::copy(a.inlineDigits, a.inlineDigits + a.length, this->inlineDigits);
+            a.digits = this->digits;
+            this->digits = this->inlineDigits;
+        } else {
+            swap(a.digits, this->digits);
+        }
         swap(a.length, this->length);
+        swap(a.capacity, this->capacity);
         swap(a.positive, this->positive);
         return *this;
     }
 
-    // Operations
     /**
-     * Adds the value of a to this number.
+     * Releases the limbs above the length - the capacity only grows otherwise. Small numbers go back to the inline
+     * storage.
      */
-    BigInteger& add(const BigInteger & a) {
-        // Enlarge by one - just in case it is necessary.
-        // Sum of two n-bit numbers can have n + 1 bits.
-        setBitLength(std::max(this->length, a.length) + 1);
-        char carry = 0;
-        char sum = 0;
-
-        // Add the shorter part.
-        for (std::size_t i = 0; i < a.length; ++i) {
-
-            sum = (carry + digits[i] + a.digits[i]);
-            carry = sum / 2;
-            digits[i] = sum % 2;
-        }
-
-        // Add the remaining part.
-        for (std::size_t i = a.length; i < this->length; ++i) {
-            sum = (carry + digits[i] + (a.positive ? 0 : 1));
-            carry = sum / 2;
-            digits[i] = sum % 2;
-        }
-
-        // What to do with the carry - use it for sign detection?
-        /*
-         * CASE 1 positive + positive (no carry possible - the added leading bits make no carry)
-         *   11 (= 3)
-         * + 11
-         * ----
-         *  110
-         *
-         * CASE 2 negative + negative (explicitly written the leading bits - it can be safely ignored), the added
-         * leading bits generate it.
-         *   111 (=-1)
-         * + 100 (=-4)
-         * -----
-         *   011 =-(100 + 1 = 101 = 5)=-5
-         *
-         * CASE 3 negative + positive and negative result
-         *   100 = -4 (the added bit is 1 therefore negative)
-         * + 011 = 3
-         * -----
-         *   111 = -1 (the first bit is 1) and no carry
-         *
-         * CASE 4 negative + positive and negative result
-         *   1100 = -4
-         * + 0111 = 7
-         *  -----
-         *   0011 = 3 and the first bit is 0 but we have a carry
-         *   (notice that the carry would propagate if we had a greater bit length)
-         */
-
-        // In case of positive vs. negative number it determines the sign of the result.
-        // In case of the same sign it can be safely ignored.
-        if (this->positive ^ a.positive) {
-            // We deduce the sign of the number using the carry.
-            this->positive = (carry == 1);
+    BigInteger& shrinkToFit(void) {
+        if (capacity > std::max(length, (std::size_t) INLINE_LIMBS)) {
+            reallocate(length, length);
         }
-
-        // Else we can ignore it and the sign of the number is not changed.
-        // Normalization - get the number of bits as small as possible.
-        normalize();
         return *this;
     }
 
     /**
-     * Switches the sign of this number - using the twos complement.
+     * The number of limbs the number can have without a new array.
      */
-    BigInteger& negate(void) {
-
-        // We can not represent 0 in two's complement, we would lose the information about zeroness.
-        if (compare(0) == 0) {
-            return *this;
-        }
-
-        // Change the flag.
-        positive = !positive;
-
-        // Do the complementing thing and add the carry.
-        char carry = 1, sum;
-
-        for (std::size_t i = 0; i < length; ++i) {
-            sum = 1 - digits[i] + carry;
-            digits[i] = sum % 2;
-            carry = sum / 2;
-        }
+    std::size_t getCapacity(void) const {
+        return capacity;
+    }
 
-        // And the last trick ;).
-        // If the number becomes positive and the previous number was e.g. -4 -> -100 -> 011 + 1 -> 100 -> 00 after
-        // normalization we have to change the bits to 11 and add +1 - we get 00 and carry +1 which can not be ignored.
-        // The problem is that we do not have a fixed bit length and we need to be careful since -2 in twos complement
-        // is represented as -2 = -10 = 01 + 1 = 10 = 1111110 or just a simple 0 after normalization.
+    // Operations
+    /**
+     * Adds the value of a to this number.
+     */
+    BigInteger& add(const BigInteger & a) {
+        return addSigned(a, a.positive);
+    }
 
-        // For example 5 = 101, -5 = 011 (in twos complement) and switching to +5 is easy 100 + 1 and there is no carry.
-        if ((carry == 1) & positive) {
-            setBitLength(length + 1);
-            digits[length - 1] = 1;
+    /**
+     * Switches the sign of this number - just the flag, zero stays positive.
+     */
+    BigInteger& negate(void) {
+        if (!isZero()) {
+            positive = !positive;
         }
-
         return *this;
     }
 
@@ -351,61 +529,67 @@ public:
      * Subtraction.
      */
     BigInteger& subtract(const BigInteger & a) {
-        BigInteger b(a);
-        b.negate();
-        add(b);
-        return *this;
+        // Adding -a, a itself stays untouched.
+        return addSigned(a, !a.positive);
     }
 
     /**
      * Multiplication.
      */
     BigInteger& multiply(const BigInteger & f) {
+        // x.multiply(x) is a square.
+        if (&f == this) {
+            return square();
+        }
 
-        BigInteger fAbs;
-        if (!f.positive) {
-            negate();
-
-            fAbs = f;
-            fAbs.negate();
-        } else {
-            fAbs = f;
+        // Zero times anything is zero.
+        if (isZero() || f.isZero()) {
+            BigInteger zero(0);
+            swap(zero);
+            return *this;
         }
 
-        fAbs.normalize();
+        // Multiply the absolute values, the sign is just the product of the signs.
+        BigInteger product(0);
+        product.setLength(length + f.length);
+        mulLimbs(product.digits, digits, length, f.digits, f.length);
+        product.positive = positive == f.positive;
+        product.normalize();
 
-        BigInteger original(0);
-        swap(original);
+        swap(product);
 
-        for (std::size_t i = fAbs.length - 1; i != (size_t) -1; --i) {
-            shiftLeft(1);
+        return *this;
+    }
 
-            if (fAbs.digits[i] == 1) {
-                add(original);
-            }
-        }
+    /**
+     * Squaring, this becomes this * this. It is faster than multiply, the kernels compute the products of the
+     * different limbs only once.
+     */
+    BigInteger& square() {
+        BigInteger product(0);
+        product.setLength(2 * length);
+        sqrLimbs(product.digits, digits, length);
+        product.normalize();
 
+        swap(product);
         return *this;
     }
 
     /**
      * Fast exponentiation - the iterative way.
+     *
+     * The exponent is processed by the sliding-window method, window is the maximal number of bits handled by one
+     * multiplication (0 chooses it by the length of k, 1 is the plain square-and-multiply).
      */
-    BigInteger& power(BigInteger k) {
+    BigInteger& power(BigInteger k, std::size_t window = 0) {
 
         BigInteger result = 1;
         if (!k.positive) {
             throw std::runtime_error("Can only power to a non-negative number.");
         }
-        k.normalize();
 
-        for (std::size_t i = k.length - 1; i != (size_t) -1; --i) {
-            result.multiply(result);
-
-            if (k.digits[i] == 1) {
-                result.multiply(*this);
-            }
-        }
+        PlainOperations operations;
+        powerWindow(result, *this, k, window, operations);
 
         swap(result);
         return *this;
@@ -414,29 +598,22 @@ public:
 
     /**
      * Fast exponentiation using the modulo operation.
+     *
+     * this becomes this^k mod m. For an odd positive m the reductions are done by the Montgomery multiplication, for
+     * an even one by the Barrett reduction. The window is the same as for power.
      */
-    BigInteger& powerMod(BigInteger k, const BigInteger & m) {
-        BigInteger result = 1;
-        if (!k.positive) {
-            throw std::runtime_error("Can only power to a non-negative number.");
-        }
-        k.normalize();
-
-        for (std::size_t i = k.length - 1; i != (size_t) -1; --i) {
-
-            result.multiply(result);
-            result.mod(m);
-
-            if (k.digits[i] == 1) {
-                result.multiply(*this);
-                result.mod(m);
-
-            }
-        }
+    BigInteger& powerMod(BigInteger k, const BigInteger & m, std::size_t window = 0);
 
-        swap(result);
-        return *this;
-    }
+    /**
+     * Modular exponentiation with a running time independent of the values, this becomes this^k mod m for an odd
+     * positive m.
+     *
+     * It is the Montgomery ladder - one multiplication and one squaring for every bit - on arrays of the length of m,
+     * the number of steps depends only on the number of limbs of k and m. There are no branches nor memory accesses
+     * depending on the bits of k and no reallocations. Only the conversion of this to the Montgomery form uses
+     * the ordinary mod. Slower than powerMod, but with the same time for all the exponents of a given length.
+     */
+    BigInteger& powerModConstTime(BigInteger k, const BigInteger & m);
 
     /**
      * Modulo operation.
@@ -452,50 +629,123 @@ public:
      */
     BigInteger& divide(const BigInteger & b);
 
+    /**
+     * Multiplication and addition in one step, this becomes this + a * b.
+     *
+     * If the shorter factor is small, the rows of the product are added directly to the limbs of this and no product
+     * is stored at all.
+     */
+    BigInteger& addMul(const BigInteger & a, const BigInteger & b) {
+        return addProduct(a, b, a.positive == b.positive);
+    }
+
+    /**
+     * Multiplication and subtraction in one step, this becomes this - a * b.
+     */
+    BigInteger& subMul(const BigInteger & a, const BigInteger & b) {
+        return addProduct(a, b, a.positive != b.positive);
+    }
+
+    /**
+     * Modular multiplication, this becomes a * b % m. The product is computed right into this number and reduced
+     * there, neither a nor b is copied.
+     */
+    BigInteger& mulMod(const BigInteger & a, const BigInteger & b, const BigInteger & m) {
+        if (this == &m) {
+            BigInteger r;
+            r.mulMod(a, b, m);
+            return swap(r);
+        }
+        setProduct(a, b);
+        return mod(m);
+    }
+
+    /**
+     * The pair (x, y) becomes (a * x + b * y, c * x + d * y). The 2x2 matrix of single word cofactors, like the one of
+     * a Lehmer step of the gcd, is applied by one pass over the limbs for each of the new numbers.
+     */
+    static void applyMatrix(BigInteger & x, BigInteger & y, long long a, long long b, long long c, long long d) {
+        BigInteger newX;
+        BigInteger newY;
+        newX.setCombination(x, a, y, b);
+        newY.setCombination(x, c, y, d);
+        x.swap(newX);
+        y.swap(newY);
+    }
+
     /**
      * Computes the absolute value.
      */
     BigInteger& abs() {
-        if (!positive) {
-            negate();
-        }
+        positive = true;
         return *this;
     }
 
     /**
      * Shifts the bits to the right.
+     *
+     * It is the division by 2^s rounded down, as the shift of the twos complement. So the absolute value of a negative
+     * number is rounded up - if any of the bits shifted out is one, -1 is added to the result.
      */
     BigInteger& shiftRight(std::size_t s) {
-        if (s < length) {
-            for (std::size_t i = 0; i != length - s; ++i) {
-                digits[i] = digits[i + s];
-            }
-        } else {
-            s = length;
+        std::size_t limbShift = s / LIMB_BITS;
+        unsigned bitShift = s % LIMB_BITS;
+
+        // Rounding of the negative numbers.
+        bool roundDown = !positive && lowestBit() < s;
+
+        // Everything is shifted out, only the sign remains (0 or -1).
+        if (limbShift >= length) {
+            setLength(0);
+            normalize();
+            return roundDown ? subtract(1) : *this;
         }
 
-        for (std::size_t i = length - s; i != length; ++i) {
-            digits[i] = (positive ? 0 : 1);
+        // Move the limbs down, the bits coming from above the last limb are zeros.
+        std::size_t newLength = length - limbShift;
+        if (bitShift == 0) {
+            std::copy(digits + limbShift, digits + length, digits);
+        } else {
+            for (std::size_t i = 0; i != newLength; ++i) {
+                Limb high = (i + limbShift + 1 < length) ? digits[i + limbShift + 1] : 0;
+                digits[i] = (digits[i + limbShift] >> bitShift) | (high << (LIMB_BITS - bitShift));
+            }
         }
 
+        setLength(newLength);
         normalize();
-        return *this;
+        return roundDown ? subtract(1) : *this;
     }
 
     /**
      * Shifts the bits to the left.
      */
     BigInteger& shiftLeft(std::size_t s) {
-        normalize();
-
-        setBitLength(length + s);
-        for (std::size_t i = length - 1; i != s - 1; --i) {
-            digits[i] = digits[i - s];
+        if (isZero()) {
+            return *this;
         }
 
-        for (std::size_t i = s - 1; i != (std::size_t) - 1; --i) {
-            digits[i] = 0;
+        std::size_t limbShift = s / LIMB_BITS;
+        unsigned bitShift = s % LIMB_BITS;
+
+        // One limb more for the bits shifted out of the last limb. The limbs are moved within the array, a new one is
+        // needed only if the capacity is exceeded.
+        std::size_t oldLength = length;
+        setLength(oldLength + limbShift + (bitShift != 0));
+
+        // Move the limbs up, starting from the most significant one.
+        if (bitShift == 0) {
+            std::copy_backward(digits, digits + oldLength, digits + oldLength + limbShift);
+        } else {
+            digits[oldLength + limbShift] = digits[oldLength - 1] >> (LIMB_BITS - bitShift);
+            for (std::size_t i = oldLength - 1; i > 0; --i) {
+                digits[i + limbShift] = (digits[i] << bitShift) | (digits[i - 1] >> (LIMB_BITS - bitShift));
+            }
+            digits[limbShift] = digits[0] << bitShift;
         }
+        std::fill(digits, digits + limbShift, (Limb) 0);
+
+        normalize();
         return *this;
     }
 
@@ -503,14 +753,15 @@ public:
      * Zero test.
      */
     bool isZero(void) const {
-        return 0 == compare(BigInteger(0));
+        return length == 0;
     }
 
     /**
      * Parity test - even numbers.
      */
     bool isEven(void) const {
-        return (1 == digits[0]) ^ positive;
+        // -x has the same parity as x.
+        return length == 0 || (digits[0] & 1) == 0;
     }
 
     /**
@@ -520,6 +771,29 @@ public:
         return !isEven();
     }
 
+    /**
+     * The index of the lowest bit set in the absolute value - the number of trailing zeros, so x is divisible by
+     * 2^lowestBit(). The number must not be zero.
+     */
+    std::size_t lowestBit(void) const {
+        std::size_t i = 0;
+        while (digits[i] == 0) {
+            ++i;
+        }
+        return i * LIMB_BITS + __builtin_ctzll(digits[i]);
+    }
+
+    /**
+     * The 64 bits of the absolute value starting at the given bit, (|x| >> start) mod 2^64.
+     */
+    Limb getBits(std::size_t start) const {
+        std::size_t i = start / LIMB_BITS;
+        unsigned s = start % LIMB_BITS;
+        Limb low = (i < length) ? digits[i] : 0;
+        Limb high = (i + 1 < length) ? digits[i + 1] : 0;
+        return (s == 0) ? low : (low >> s) | (high << (LIMB_BITS - s));
+    }
+
     /**
      * Comparison.
      *
@@ -528,8 +802,6 @@ public:
      * return 1 if this > b
      */
     int compare(const BigInteger & b) const {
-
-
         // I am greater than zero and b is not.
         if (positive and !b.positive) {
             return 1;
@@ -540,67 +812,18 @@ public:
             return -1;
         }
 
-        // Make them both positive.
-        if (!positive) {
-            BigInteger abs(*this);
-            abs.negate();
-            BigInteger bAbs(b);
-            bAbs.negate();
-
-            int res = -abs.compare(bAbs);
-
-            return res;
-        }
-
-
-        // Compare the positive numbers, without normalization.
-        size_t tD;
-        size_t bD;
-
-        // Go from the significant bits to the left. If they differ return the appropriate result.
-        for (std::size_t i = std::max(length, b.length) - 1; i != (size_t) - 1; --i) {
-
-            // If i-th digit is greater then the bit length fill it with zero. We are positive.
-            if (i >= length) {
-                tD = 0;
-            } else {
-                tD = digits[i];
-            }
-
-            // The same for b.
-            if (i >= b.length) {
-                bD = 0;
-            } else {
-                bD = b.digits[i];
-            }
-
-
-            // Compare the bits.
-            if (tD < bD) {
-                return -1;
-            } else if (tD > bD) {
-                return 1;
-            }
-        }
-
-        // Fine we got here - the numbers are the same.
-        return 0;
+        // Both have the same sign, so compare the absolute values - the larger negative one is the smaller number.
+        int result = compareLimbs(digits, length, b.digits, b.length);
+        return positive ? result : -result;
     }
 
     /**
      * Conversion to int.
      */
     int intValue(void) const {
-        // Set it up.
-        int value = positive ? 0 : -1;
-
-        // Just copy it ;) using shifts.
-        for (std::size_t i = length - 1; i != (std::size_t) -1; --i) {
-            value <<= 1;
-            value |= digits[i];
-        }
-
-        return value;
+        // The lowest bits of the twos complement, the negation is done modulo 2^64.
+        Limb low = length > 0 ? digits[0] : 0;
+        return (int) (positive ? low : (Limb) 0 - low);
     }
 
     /**
@@ -616,241 +839,2634 @@ public:
 
 private:
     /**
-     * Normalize the number.
+     * Adds the absolute value of a with the sign given by aPositive - so add and subtract are the same thing. Numbers
+     * of the same sign add their absolute values, otherwise the smaller absolute value is subtracted from the larger
+     * one which gives the sign.
      */
-    BigInteger& normalize(void) {
-        // Removes the starting zeros (for positive) or ones (for negative) numbers.
-        std::size_t newLength = length;
-        for (std::size_t i = length - 1; i != (std::size_t) -1; --i) {
-            if (digits[i] == (positive ? 0 : 1)) {
-                --newLength;
-            } else {
-                break;
-            }
+    BigInteger& addSigned(const BigInteger & a, bool aPositive) {
+        // a might be us, so remember its length before the resizing.
+        const std::size_t aLength = a.length;
+
+        if (positive == aPositive) {
+            setLength(std::max(length, aLength) + 1);
+            addLimbs(digits, digits, length, a.digits, aLength);
+        } else if (compareLimbs(digits, length, a.digits, aLength) >= 0) {
+            subLimbs(digits, digits, length, a.digits, aLength);
+        } else {
+            // |a| - |this| is written over this, subLimbs reads every limb of this before it writes it.
+            const std::size_t thisLength = length;
+            setLength(aLength);
+            subLimbs(digits, a.digits, aLength, digits, thisLength);
+            positive = aPositive;
         }
 
-        setBitLength(newLength);
+        normalize();
         return *this;
     }
 
     /**
-     * Set the bit length of the number.
+     * This becomes a * b, the product is computed into the limbs of this.
      */
-    BigInteger& setBitLength(std::size_t newLength) {
-        if (newLength == length) {
-            return *this;
+    BigInteger& setProduct(const BigInteger & a, const BigInteger & b) {
+        // The kernels need the product apart from the factors.
+        if (this == &a || this == &b) {
+            BigInteger product;
+            product.setProduct(a, b);
+            return swap(product);
         }
 
-        // New array.
-        char * newDigits = new char [newLength];
-        std::copy(digits, digits + std::min(length, newLength), newDigits);
-        /*for (std::size_t i = 0; i < std::min(length, newLength); ++i) {
-        	newDigits[i] = digits[i];
-        }*/
-
-        // Pad according to the positive/negative status.
-        for (std::size_t i = length; i < newLength; ++i) {
-            newDigits[i] = (positive ? 0 : 1);
+        if (a.isZero() || b.isZero()) {
+            setLength(0);
+            return normalize();
         }
 
-        // Release the old array.
-        delete [] digits;
-        digits = newDigits;
-
-        // Remember the new length.
-        length = newLength;
+        setLength(a.length + b.length);
+        mulLimbs(digits, a.digits, a.length, b.digits, b.length);
+        positive = a.positive == b.positive;
+        return normalize();
+    }
 
-        return *this;
+    /**
+     * This becomes a * x + b * y for the single word a and b, this must be neither x nor y.
+     */
+    BigInteger& setCombination(const BigInteger & x, long long a, const BigInteger & y, long long b) {
+        // The signs of the two terms and their absolute values.
+        bool xTermPositive = x.positive == (a >= 0);
+        bool yTermPositive = y.positive == (b >= 0);
+        Limb aAbs = (a >= 0) ? (Limb) a : (Limb) 0 - (Limb) a;
+        Limb bAbs = (b >= 0) ? (Limb) b : (Limb) 0 - (Limb) b;
+
+        setLength(std::max(x.length, y.length) + 1);
+        bool subtract = xTermPositive != yTermPositive;
+        bool negative = combineLimbs(digits, x.digits, x.length, aAbs, y.digits, y.length, bAbs, subtract);
+        positive = xTermPositive != negative;
+        return normalize();
     }
 
-    std::string rawBits(void) const {
-        std::stringstream str;
-        for (size_t i = length - 1; i != (size_t) -1; --i) {
-            str << (std::size_t) digits[i];
+    /**
+     * Adds the product of a and b with the sign given by productPositive - the common part of addMul and subMul.
+     *
+     * If the absolute value of the product is added, or subtracted from a longer number, and the shorter factor is
+     * below the Karatsuba threshold, each limb of it adds (or subtracts) one row of the schoolbook product to this.
+     * Otherwise the product is computed by the fast multiplication and then added.
+     */
+    BigInteger& addProduct(const BigInteger & a, const BigInteger & b, bool productPositive) {
+        if (a.isZero() || b.isZero()) {
+            return *this;
+        }
+
+        const BigInteger & shorter = a.length < b.length ? a : b;
+        const BigInteger & longer = a.length < b.length ? b : a;
+        const std::size_t productLength = a.length + b.length;
+        bool rows = this != &a && this != &b && shorter.length < thresholds().karatsuba;
+
+        if (rows && (isZero() || positive == productPositive)) {
+            // The product is added to the absolute value.
+            positive = productPositive;
+            setLength(std::max(length, productLength) + 1);
+            for (std::size_t j = 0; j < shorter.length; ++j) {
+                Limb * row = digits + j;
+                Limb carry = addMulLimb(row, longer.digits, longer.length, shorter.digits[j]);
+                addLimbs(row + longer.length, row + longer.length, length - j - longer.length, &carry, 1);
+            }
+        } else if (rows && length > productLength) {
+            // The product is subtracted from a longer absolute value, the sign stays.
+            for (std::size_t j = 0; j < shorter.length; ++j) {
+                Limb * row = digits + j;
+                Limb borrow = subMulLimb(row, longer.digits, longer.length, shorter.digits[j]);
+                subLimbs(row + longer.length, row + longer.length, length - j - longer.length, &borrow, 1);
+            }
+        } else {
+            BigInteger product;
+            product.setProduct(a, b);
+            return addSigned(product, productPositive);
+        }
+
+        return normalize();
+    }
+
+    /**
+     * Test of the i-th bit (of the twos complement).
+     *
+     * The twos complement of a negative number with the lowest bit t set in its absolute value has zeros below t, one
+     * at t and the inverted bits of the absolute value above t.
+     */
+    bool testBit(std::size_t i) const {
+        bool bit = (i / LIMB_BITS < length) && ((digits[i / LIMB_BITS] >> (i % LIMB_BITS)) & 1);
+        if (positive) {
+            return bit;
+        }
+        std::size_t t = lowestBit();
+        return i < t ? false : (i == t ? true : !bit);
+    }
+
+    /**
+     * Sets this to a random non-negative number of at most the given bit length.
+     */
+    BigInteger& randomBits(std::size_t bits) {
+        positive = true;
+        setLength((bits + LIMB_BITS - 1) / LIMB_BITS);
+        RandomEngine & engine = randomEngine();
+        for (std::size_t i = 0; i < length; ++i) {
+            digits[i] = engine.next();
+        }
+
+        // Cut the bits above the bit length.
+        if (bits % LIMB_BITS != 0) {
+            digits[length - 1] &= ((Limb) 1 << (bits % LIMB_BITS)) - 1;
+        }
+
+        normalize();
+        return *this;
+    }
+
+    /**
+     * A small random generator (SplitMix64), so the header does not need <random> - it brings <numeric> and with it
+     * std::gcd, which would take over gcd(12, 9) in the drivers using namespace std.
+     */
+    struct RandomEngine {
+        std::uint64_t state;
+
+        Limb next(void) {
+            std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+    };
+
+    /**
+     * The random generator of the calling thread. The threads do not share any state, every one has its own generator
+     * seeded by the order in which the threads ask for the first random number, so the numbers are reproducible.
+     */
+    static RandomEngine & randomEngine() {
+        static std::atomic<unsigned> threads(0);
+        static thread_local RandomEngine engine = {5489u + threads++};
+        return engine;
+    }
+
+    /**
+     * Normalize the number.
+     */
+    BigInteger& normalize(void) {
+        // Removes the starting zero limbs, the zero is positive.
+        std::size_t newLength = length;
+        while (newLength > 0 && digits[newLength - 1] == 0) {
+            --newLength;
+        }
+
+        setLength(newLength);
+        if (length == 0) {
+            positive = true;
+        }
+        return *this;
+    }
+
+    /**
+     * Set the length (in limbs) of the number, the new limbs are zeros.
+     *
+     * The array is replaced only if the capacity is not enough, then it grows at least twice, so a number growing limb
+     * by limb is copied O(1) times per limb. A shorter length keeps the array, see shrinkToFit.
+     */
+    BigInteger& setLength(std::size_t newLength) {
+        if (newLength > capacity) {
+            reallocate(std::max(newLength, 2 * capacity), length);
+        }
+        if (newLength > length) {
+            std::fill(digits + length, digits + newLength, (Limb) 0);
+        }
+        length = newLength;
+        return *this;
+    }
+
+    /**
+     * Replaces the array by one for newCapacity limbs (the inline storage if it is large enough) and copies the first
+     * keep limbs there.
+     */
+    void reallocate(std::size_t newCapacity, std::size_t keep) {
+        Limb * newDigits = allocate(newCapacity);
+        if (newDigits != digits) {
+            std::copy(digits, digits + keep, newDigits);
+            release(digits, capacity);
+            digits = newDigits;
+        }
+        capacity = std::max(newCapacity, (std::size_t) INLINE_LIMBS);
+    }
+
+    /**
+     * Limb array for n limbs - the inline storage if it is large enough, a new heap array otherwise.
+     */
+    Limb * allocate(std::size_t n) {
+        AllocationCounter & counter = allocationCounter();
+        if (n <= INLINE_LIMBS) {
+            counter.inlineBuffers += (n > 0);
+            return inlineDigits;
+        }
+        ++counter.heapBuffers;
+        return resource ? resource->allocate(n) : poolAllocate(n);
+    }
+
+    /**
+     * Releases the array of n limbs obtained from allocate.
+     */
+    void release(Limb * array, std::size_t n) {
+        if (array != inlineDigits) {
+            if (resource) {
+                resource->deallocate(array, n);
+            } else {
+                poolDeallocate(array, n);
+            }
+        }
+    }
+
+    /**
+     * The resource of the numbers created by the calling thread, 0 for the pool.
+     */
+    static MemoryResource *& currentResource() {
+        static thread_local MemoryResource * resource = 0;
+        return resource;
+    }
+
+    /**
+     * The resource of the thread set for the lifetime of the scope.
+     */
+    struct ResourceScope {
+        MemoryResource * previous;
+
+        explicit ResourceScope(MemoryResource * resource):
+            previous(setResource(resource)) {
+        }
+
+        ~ResourceScope() {
+            setResource(previous);
+        }
+    };
+
+    /**
+     * The thread-local pool keeps the released arrays for the reuse, at most POOL_CACHED of every size. The sizes are
+     * rounded up to the POOL_CLASSES powers of two 8, 16, ..., 2^16 limbs, so any array fits into the list of its size
+     * class and a thread can free the arrays allocated by another one without any lock. Larger arrays are not cached.
+     */
+    static const std::size_t POOL_CLASSES = 14;
+    static const std::size_t POOL_CACHED = 8;
+
+    struct Pool {
+        std::vector<Limb *> cached[POOL_CLASSES];
+
+        ~Pool() {
+            for (std::size_t c = 0; c < POOL_CLASSES; ++c) {
+                for (std::size_t i = 0; i < cached[c].size(); ++i) {
+                    delete [] cached[c][i];
+                }
+            }
+            poolState() = POOL_DESTROYED;
+        }
+    };
+
+    enum PoolState {POOL_UNUSED, POOL_ALIVE, POOL_DESTROYED};
+
+    /**
+     * The state of the pool of the thread. The numbers destroyed after the pool (the static ones) free their arrays
+     * directly.
+     */
+    static PoolState & poolState() {
+        static thread_local PoolState state = POOL_UNUSED;
+        return state;
+    }
+
+    /**
+     * The pool of the calling thread, 0 if it is destroyed already.
+     */
+    static Pool * pool() {
+        if (poolState() == POOL_DESTROYED) {
+            return 0;
+        }
+        static thread_local Pool threadPool;
+        poolState() = POOL_ALIVE;
+        return &threadPool;
+    }
+
+    /**
+     * The size class of an array of n limbs and its size, the class POOL_CLASSES is not cached.
+     */
+    static std::size_t poolClass(std::size_t n, std::size_t & size) {
+        std::size_t c = 0;
+        size = 8;
+        while (size < n && c < POOL_CLASSES) {
+            size *= 2;
+            ++c;
+        }
+        if (c == POOL_CLASSES) {
+            size = n;
+        }
+        return c;
+    }
+
+    static Limb * poolAllocate(std::size_t n) {
+        std::size_t size;
+        std::size_t c = poolClass(n, size);
+        Pool * p = pool();
+        if (p && c < POOL_CLASSES && !p->cached[c].empty()) {
+            Limb * array = p->cached[c].back();
+            p->cached[c].pop_back();
+            return array;
+        }
+        return new Limb [size];
+    }
+
+    static void poolDeallocate(Limb * array, std::size_t n) {
+        std::size_t size;
+        std::size_t c = poolClass(n, size);
+        Pool * p = pool();
+        if (p && c < POOL_CLASSES && p->cached[c].size() < POOL_CACHED) {
+            p->cached[c].push_back(array);
+        } else {
+            delete [] array;
+        }
+    }
+
+    /**
+     * The largest window size accepted by the exponentiation, the table has 2^(window - 1) entries.
+     */
+    static const std::size_t MAX_WINDOW = 16;
+
+    /**
+     * The window size for an exponent of the given bit length. A window of w bits needs a table of 2^(w-1) odd powers
+     * and saves multiplications - about bits / (w + 1) of them are left instead of bits / 2.
+     */
+    static std::size_t windowSize(std::size_t bits) {
+        static const std::size_t limits[] = {8, 24, 80, 240, 672};
+        std::size_t window = 1;
+        while (window <= 5 && bits > limits[window - 1]) {
+            ++window;
+        }
+        return window;
+    }
+
+    /**
+     * Multiplication and squaring without any reduction, for power.
+     */
+    struct PlainOperations {
+        void square(BigInteger & x) {
+            x.square();
+        }
+
+        void multiply(BigInteger & x, const BigInteger & y) {
+            x.multiply(y);
+        }
+    };
+
+    /**
+     * Sliding-window exponentiation result = result * base^k.
+     *
+     * We precompute the odd powers base, base^3, ..., base^(2^window - 1). The exponent is scanned from the highest bit,
+     * a zero bit costs one squaring and a window of at most window bits starting and ending with a one costs
+     * the squarings and a single multiplication by the entry of the table. The operations object supplies
+     * square(x) and multiply(x, y) working on the Number type, so the same scan serves all the kinds of reduction.
+     * result must be the one of the Number type, the first window just copies the table entry into it.
+     */
+    template <class Operations, class Number>
+    static void powerWindow(Number & result, const Number & base, const BigInteger & k, std::size_t window,
+                            Operations & operations) {
+        std::size_t bits = k.getLength();
+        if (window == 0) {
+            window = windowSize(bits);
+        }
+        if (window > MAX_WINDOW) {
+            throw std::runtime_error("The window of the exponentiation is too large.");
+        }
+
+        // The table of the odd powers.
+        std::vector<Number> table((std::size_t) 1 << (window - 1), base);
+        if (table.size() > 1) {
+            Number base2(base);
+            operations.square(base2);
+            for (std::size_t i = 1; i < table.size(); ++i) {
+                table[i] = table[i - 1];
+                operations.multiply(table[i], base2);
+            }
+        }
+
+        bool started = false;
+        for (std::size_t i = bits - 1; i != (std::size_t) -1;) {
+            if (!k.testBit(i)) {
+                if (started) {
+                    operations.square(result);
+                }
+                --i;
+                continue;
+            }
+
+            // The window of bits i..j with a one in the bit j.
+            std::size_t j = (i + 1 >= window) ? i + 1 - window : 0;
+            while (!k.testBit(j)) {
+                ++j;
+            }
+            std::size_t value = 0;
+            for (std::size_t l = i + 1; l-- > j;) {
+                value = 2 * value + k.testBit(l);
+            }
+
+            if (started) {
+                for (std::size_t l = j; l <= i; ++l) {
+                    operations.square(result);
+                }
+                operations.multiply(result, table[value / 2]);
+            } else {
+                result = table[value / 2];
+                started = true;
+            }
+            i = j - 1;
+        }
+    }
+
+    /**
+     * Swaps a[0..n) and b[0..n) if bit is 1 and leaves them if it is 0, without a branch.
+     */
+    static void conditionalSwap(Limb * a, Limb * b, std::size_t n, Limb bit) {
+        Limb mask = -bit;
+        for (std::size_t i = 0; i < n; ++i) {
+            Limb t = (a[i] ^ b[i]) & mask;
+            a[i] ^= t;
+            b[i] ^= t;
+        }
+    }
+
+    /**
+     * Number of significant bits of a single limb.
+     */
+    static unsigned limbBitLength(Limb x) {
+        return x == 0 ? 0 : LIMB_BITS - __builtin_clzll(x);
+    }
+
+    /**
+     * r[0..n) += a[0..n) * b, returns the carry limb.
+     */
+    static Limb addMulLimb(Limb * r, const Limb * a, std::size_t n, Limb b) {
+        Limb carry = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            DoubleLimb t = (DoubleLimb) a[i] * b + r[i] + carry;
+            r[i] = (Limb) t;
+            carry = (Limb) (t >> LIMB_BITS);
+        }
+        return carry;
+    }
+
+    /**
+     * Schoolbook multiplication r[0..an+bn) = a[0..an) * b[0..bn), r must not overlap a nor b.
+     */
+    static void mulBasecase(Limb * r, const Limb * a, std::size_t an, const Limb * b, std::size_t bn) {
+        std::fill(r, r + an + bn, 0);
+        for (std::size_t j = 0; j < bn; ++j) {
+            r[an + j] = addMulLimb(r + j, a, an, b[j]);
+        }
+    }
+
+    /**
+     * Schoolbook squaring r[0..2n) = a[0..n)^2, r must not overlap a.
+     *
+     * The products a[i] * a[j] for i != j appear twice, so we compute only those with i < j, double them with a shift
+     * and add the squares a[i]^2 - about half of the multiplications of mulBasecase.
+     */
+    static void sqrBasecase(Limb * r, const Limb * a, std::size_t n) {
+        std::fill(r, r + 2 * n, 0);
+        for (std::size_t i = 0; i + 1 < n; ++i) {
+            r[i + n] = addMulLimb(r + 2 * i + 1, a + i + 1, n - i - 1, a[i]);
+        }
+        shiftLeftLimbs(r, r, 2 * n, 1);
+
+        Limb carry = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            DoubleLimb square = (DoubleLimb) a[i] * a[i];
+            DoubleLimb sum = (DoubleLimb) r[2 * i] + (Limb) square + carry;
+            r[2 * i] = (Limb) sum;
+            sum = (sum >> LIMB_BITS) + r[2 * i + 1] + (Limb) (square >> LIMB_BITS);
+            r[2 * i + 1] = (Limb) sum;
+            carry = (Limb) (sum >> LIMB_BITS);
+        }
+    }
+
+    /**
+     * r[0..an) = a[0..an) + b[0..bn) for an >= bn, returns the carry. r can be the same array as a.
+     */
+    static Limb addLimbs(Limb * r, const Limb * a, std::size_t an, const Limb * b, std::size_t bn) {
+        Limb carry = 0;
+        for (std::size_t i = 0; i < bn; ++i) {
+            DoubleLimb sum = (DoubleLimb) a[i] + b[i] + carry;
+            r[i] = (Limb) sum;
+            carry = (Limb) (sum >> LIMB_BITS);
+        }
+        for (std::size_t i = bn; i < an; ++i) {
+            r[i] = a[i] + carry;
+            carry = carry && r[i] == 0;
+        }
+        return carry;
+    }
+
+    /**
+     * r[0..an) = a[0..an) - b[0..bn) for an >= bn, returns the borrow. r can be the same array as a.
+     */
+    static Limb subLimbs(Limb * r, const Limb * a, std::size_t an, const Limb * b, std::size_t bn) {
+        Limb borrow = 0;
+        for (std::size_t i = 0; i < bn; ++i) {
+            DoubleLimb diff = (DoubleLimb) a[i] - b[i] - borrow;
+            r[i] = (Limb) diff;
+            borrow = (Limb) (diff >> LIMB_BITS) & 1;
+        }
+        for (std::size_t i = bn; i < an; ++i) {
+            Limb ai = a[i];
+            r[i] = ai - borrow;
+            borrow = borrow && ai == 0;
+        }
+        return borrow;
+    }
+
+    /**
+     * Comparison of a[0..an) and b[0..bn) as unsigned numbers, returns -1, 0 or 1.
+     */
+    static int compareLimbs(const Limb * a, std::size_t an, const Limb * b, std::size_t bn) {
+        while (an > bn) {
+            if (a[--an] != 0) {
+                return 1;
+            }
+        }
+        while (bn > an) {
+            if (b[--bn] != 0) {
+                return -1;
+            }
+        }
+        for (std::size_t i = an - 1; i != (std::size_t) -1; --i) {
+            if (a[i] != b[i]) {
+                return a[i] < b[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * r[0..n] = |a * x[0..xn) - b * y[0..yn)| for n = max(xn, yn), or the sum a * x + b * y if subtract is false.
+     * Returns true if the difference is negative. One pass, both products are formed limb by limb.
+     */
+    static bool combineLimbs(Limb * r, const Limb * x, std::size_t xn, Limb a, const Limb * y, std::size_t yn, Limb b,
+                             bool subtract) {
+        std::size_t n = std::max(xn, yn);
+        Limb xCarry = 0;
+        Limb yCarry = 0;
+        Limb borrow = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            DoubleLimb xt = (DoubleLimb) a * (i < xn ? x[i] : 0) + xCarry;
+            DoubleLimb yt = (DoubleLimb) b * (i < yn ? y[i] : 0) + yCarry;
+            xCarry = (Limb) (xt >> LIMB_BITS);
+            yCarry = (Limb) (yt >> LIMB_BITS);
+            if (subtract) {
+                DoubleLimb diff = (DoubleLimb) (Limb) xt - (Limb) yt - borrow;
+                r[i] = (Limb) diff;
+                borrow = (Limb) (diff >> LIMB_BITS) & 1;
+            } else {
+                DoubleLimb sum = (DoubleLimb) (Limb) xt + (Limb) yt + borrow;
+                r[i] = (Limb) sum;
+                borrow = (Limb) (sum >> LIMB_BITS);
+            }
+        }
+
+        // The top limbs are the carries of the products. The factors come from long long, so they are at most 2^63 and
+        // the result fits into n + 1 limbs.
+        if (!subtract) {
+            r[n] = xCarry + yCarry + borrow;
+            return false;
+        }
+        r[n] = xCarry - yCarry - borrow;
+        if (xCarry >= yCarry + borrow) {
+            return false;
+        }
+
+        // The difference is negative, r holds its twos complement.
+        Limb carry = 1;
+        for (std::size_t i = 0; i <= n; ++i) {
+            DoubleLimb t = (DoubleLimb) (Limb) ~r[i] + carry;
+            r[i] = (Limb) t;
+            carry = (Limb) (t >> LIMB_BITS);
+        }
+        return true;
+    }
+
+    /**
+     * r[0..an) = |a[0..an) - b[0..bn)| for an >= bn, returns true if a < b.
+     */
+    static bool absDiffLimbs(Limb * r, const Limb * a, std::size_t an, const Limb * b, std::size_t bn) {
+        if (compareLimbs(a, an, b, bn) >= 0) {
+            subLimbs(r, a, an, b, bn);
+            return false;
+        }
+        // b is the larger one, so the limbs of a above bn are zero.
+        subLimbs(r, b, bn, a, bn);
+        std::fill(r + bn, r + an, 0);
+        return true;
+    }
+
+    /**
+     * Multiplication r[0..an+bn) = a[0..an) * b[0..bn) choosing the algorithm by the operand lengths. r must not
+     * overlap a nor b.
+     */
+    static void mulLimbs(Limb * r, const Limb * a, std::size_t an, const Limb * b, std::size_t bn) {
+        if (a == b && an == bn) {
+            sqrLimbs(r, a, an);
+            return;
+        }
+
+        if (an < bn) {
+            std::swap(a, b);
+            std::swap(an, bn);
+        }
+
+        // At least four limbs, the halves must not get empty.
+        std::size_t threshold = std::max(thresholds().karatsuba, (std::size_t) 4);
+        if (bn < threshold) {
+            mulBasecase(r, a, an, b, bn);
+            return;
+        }
+
+        if (bn >= thresholds().ntt) {
+            mulNtt(r, a, an, b, bn);
+            return;
+        }
+
+        if (an == bn && bn >= std::max(thresholds().toom3, (std::size_t) 9)) {
+            mulToom3(r, a, b, bn);
+            return;
+        }
+
+        if (an == bn) {
+            std::vector<Limb> scratch(karatsubaScratch(bn, threshold));
+            mulKaratsuba(r, a, b, bn, scratch.data(), threshold);
+            return;
+        }
+
+        // Unbalanced operands - multiply b by the bn-limb pieces of a and add the partial products.
+        std::fill(r, r + an + bn, 0);
+        std::vector<Limb> product(2 * bn);
+        for (std::size_t offset = 0; offset < an; offset += bn) {
+            std::size_t n = std::min(bn, an - offset);
+            mulLimbs(product.data(), a + offset, n, b, bn);
+            addLimbs(r + offset, r + offset, an + bn - offset, product.data(), n + bn);
+        }
+    }
+
+    /**
+     * Squaring r[0..2n) = a[0..n)^2 choosing the algorithm by the length. r must not overlap a.
+     */
+    static void sqrLimbs(Limb * r, const Limb * a, std::size_t n) {
+        std::size_t threshold = std::max(thresholds().karatsuba, (std::size_t) 4);
+        if (n < threshold) {
+            sqrBasecase(r, a, n);
+            return;
+        }
+
+        // The transform and Toom-3 notice that both operands are the same and do only half of the work.
+        if (n >= thresholds().ntt) {
+            mulNtt(r, a, n, a, n);
+            return;
+        }
+
+        if (n >= std::max(thresholds().toom3, (std::size_t) 9)) {
+            mulToom3(r, a, a, n);
+            return;
+        }
+
+        std::vector<Limb> scratch(karatsubaScratch(n, threshold));
+        sqrKaratsuba(r, a, n, scratch.data(), threshold);
+    }
+
+    /**
+     * Number of scratch limbs needed by mulKaratsuba (and sqrKaratsuba) for n-limb operands.
+     */
+    static std::size_t karatsubaScratch(std::size_t n, std::size_t threshold) {
+        std::size_t size = 0;
+        while (n >= threshold) {
+            std::size_t m = n - n / 2;
+            size += 6 * m + 1;
+            n = m;
+        }
+        return size;
+    }
+
+    /**
+     * Karatsuba multiplication r[0..2n) = a[0..n) * b[0..n).
+     *
+     * With a = a1 * B^m + a0 and b = b1 * B^m + b0 we need just three products of half the length, since
+     * a0 * b1 + a1 * b0 = a0 * b0 + a1 * b1 - (a0 - a1) * (b0 - b1).
+     */
+    static void mulKaratsuba(Limb * r, const Limb * a, const Limb * b, std::size_t n, Limb * scratch,
+                             std::size_t threshold) {
+        if (n < threshold) {
+            mulBasecase(r, a, n, b, n);
+            return;
+        }
+
+        // Split into the low parts of m limbs and the high parts of h <= m limbs.
+        std::size_t m = n - n / 2;
+        std::size_t h = n / 2;
+        Limb * aDiff = scratch;
+        Limb * bDiff = aDiff + m;
+        Limb * t = bDiff + m;
+        Limb * mid = t + 2 * m;
+        Limb * next = mid + 2 * m + 1;
+
+        bool aNegative = absDiffLimbs(aDiff, a, m, a + m, h);
+        bool bNegative = absDiffLimbs(bDiff, b, m, b + m, h);
+
+        // The low and the high product go directly to their places in the result.
+        mulKaratsuba(r, a, b, m, next, threshold);
+        mulKaratsuba(r + 2 * m, a + m, b + m, h, next, threshold);
+        mulKaratsuba(t, aDiff, bDiff, m, next, threshold);
+
+        // mid = a0 * b0 + a1 * b1 -+ |a0 - a1| * |b0 - b1|, it is never negative.
+        std::copy(r, r + 2 * m, mid);
+        mid[2 * m] = addLimbs(mid, mid, 2 * m, r + 2 * m, 2 * h);
+        if (aNegative == bNegative) {
+            subLimbs(mid, mid, 2 * m + 1, t, 2 * m);
+        } else {
+            addLimbs(mid, mid, 2 * m + 1, t, 2 * m);
+        }
+
+        // Add the middle part shifted by m limbs.
+        addLimbs(r + m, r + m, 2 * n - m, mid, std::min(2 * m + 1, 2 * n - m));
+    }
+
+    /**
+     * Karatsuba squaring r[0..2n) = a[0..n)^2, the three half-length products are squares as well:
+     * 2 * a0 * a1 = a0^2 + a1^2 - (a0 - a1)^2.
+     */
+    static void sqrKaratsuba(Limb * r, const Limb * a, std::size_t n, Limb * scratch, std::size_t threshold) {
+        if (n < threshold) {
+            sqrBasecase(r, a, n);
+            return;
+        }
+
+        std::size_t m = n - n / 2;
+        std::size_t h = n / 2;
+        Limb * aDiff = scratch;
+        Limb * t = aDiff + m;
+        Limb * mid = t + 2 * m;
+        Limb * next = mid + 2 * m + 1;
+
+        absDiffLimbs(aDiff, a, m, a + m, h);
+
+        sqrKaratsuba(r, a, m, next, threshold);
+        sqrKaratsuba(r + 2 * m, a + m, h, next, threshold);
+        sqrKaratsuba(t, aDiff, m, next, threshold);
+
+        // mid = a0^2 + a1^2 - (a0 - a1)^2, the sign of the difference does not matter.
+        std::copy(r, r + 2 * m, mid);
+        mid[2 * m] = addLimbs(mid, mid, 2 * m, r + 2 * m, 2 * h);
+        subLimbs(mid, mid, 2 * m + 1, t, 2 * m);
+
+        addLimbs(r + m, r + m, 2 * n - m, mid, std::min(2 * m + 1, 2 * n - m));
+    }
+
+    /**
+     * Toom-Cook 3-way multiplication r[0..2n) = a[0..n) * b[0..n).
+     *
+     * The operands are split into three parts a = a2 * x^2 + a1 * x + a0 with x = B^k. The product is a polynomial of
+     * degree four, we evaluate it in the points 0, 1, -1, -2 and infinity with five multiplications of a third of the
+     * length and interpolate the coefficients back (the sequence of Bodrato, it needs just exact divisions by 2 and 3).
+     * The interpolation works with twos complement numbers of a fixed length w, which is enough for all the values.
+     */
+    static void mulToom3(Limb * r, const Limb * a, const Limb * b, std::size_t n) {
+        std::size_t k = (n + 2) / 3;
+        std::size_t h = n - 2 * k;
+        std::size_t w = 2 * k + 2;
+
+        std::vector<Limb> buffer(6 * (k + 1) + 5 * w);
+        Limb * p1 = buffer.data();
+        Limb * pm1 = p1 + (k + 1);
+        Limb * pm2 = pm1 + (k + 1);
+        Limb * q1 = pm2 + (k + 1);
+        Limb * qm1 = q1 + (k + 1);
+        Limb * qm2 = qm1 + (k + 1);
+        Limb * r0 = qm2 + (k + 1);
+        Limb * r1 = r0 + w;
+        Limb * rm1 = r1 + w;
+        Limb * rm2 = rm1 + w;
+        Limb * rInf = rm2 + w;
+
+        // Evaluation in 1, -1 and -2, we remember the signs separately. For a square we evaluate just once, then
+        // the products below get the same array twice and are squares too.
+        bool pm1Negative, pm2Negative, qm1Negative, qm2Negative;
+        evaluateToom3(a, k, h, p1, pm1, pm2, pm1Negative, pm2Negative, r0);
+        if (a == b) {
+            q1 = p1;
+            qm1 = pm1;
+            qm2 = pm2;
+            qm1Negative = pm1Negative;
+            qm2Negative = pm2Negative;
+        } else {
+            evaluateToom3(b, k, h, q1, qm1, qm2, qm1Negative, qm2Negative, r0);
+        }
+
+        // The five products.
+        signedProduct(r0, w, a, k, b, k, false);
+        signedProduct(r1, w, p1, k + 1, q1, k + 1, false);
+        signedProduct(rm1, w, pm1, k + 1, qm1, k + 1, pm1Negative != qm1Negative);
+        signedProduct(rm2, w, pm2, k + 1, qm2, k + 1, pm2Negative != qm2Negative);
+        signedProduct(rInf, w, a + 2 * k, h, b + 2 * k, h, false);
+
+        // Interpolation, the values are in twos complement - carries and borrows out of w limbs are ignored.
+        Limb * r2 = rm1;
+        Limb * r3 = rm2;
+        subLimbs(r3, rm2, w, r1, w);                        // r3 = (r(-2) - r(1)) / 3
+        divExactLimbs(r3, r3, w, 3);
+        subLimbs(r1, r1, w, rm1, w);                        // r1 = (r(1) - r(-1)) / 2
+        shiftRightSigned(r1, w, 1);
+        subLimbs(r2, rm1, w, r0, w);                        // r2 = r(-1) - r(0)
+        subLimbs(r3, r2, w, r3, w);                         // r3 = (r2 - r3) / 2 + 2 * r(inf)
+        shiftRightSigned(r3, w, 1);
+        addLimbs(r3, r3, w, rInf, w);
+        addLimbs(r3, r3, w, rInf, w);
+        addLimbs(r2, r2, w, r1, w);                         // r2 = r2 + r1 - r(inf)
+        subLimbs(r2, r2, w, rInf, w);
+        subLimbs(r1, r1, w, r3, w);                         // r1 = r1 - r3
+
+        // All the coefficients are non-negative now, sum them up.
+        std::fill(r, r + 2 * n, 0);
+        const Limb * coefficients[] = {r0, r1, r2, r3, rInf};
+        for (std::size_t i = 0; i < 5; ++i) {
+            std::size_t offset = i * k;
+            addLimbs(r + offset, r + offset, 2 * n - offset, coefficients[i], std::min(w, 2 * n - offset));
+        }
+    }
+
+    /**
+     * Arithmetic modulo a prime p < 2^63 for the number-theoretic transform. The numbers are kept in the Montgomery
+     * form x * R mod p with R = 2^64, so a multiplication needs no division.
+     */
+    struct NttPrime {
+        /**
+         * The prime, p - 1 is divisible by 2^48.
+         */
+        Limb p;
+
+        /**
+         * -p^-1 mod R.
+         */
+        Limb pInverse;
+
+        /**
+         * R^2 mod p, for the conversion to the Montgomery form.
+         */
+        Limb r2;
+
+        /**
+         * A generator of the multiplicative group modulo p.
+         */
+        Limb generator;
+
+        NttPrime(Limb prime, Limb g):
+            p(prime),
+            pInverse(0),
+            r2(0),
+            generator(g) {
+            // Newton's iteration for p^-1 mod R.
+            Limb inverse = p;
+            for (int i = 0; i < 5; ++i) {
+                inverse *= 2 - p * inverse;
+            }
+            pInverse = -inverse;
+            Limb r = (Limb) ((((DoubleLimb) 1) << LIMB_BITS) % p);
+            r2 = (Limb) ((DoubleLimb) r * r % p);
+        }
+
+        /**
+         * a * b / R mod p (Montgomery reduction of the product).
+         */
+        Limb mul(Limb a, Limb b) const {
+            DoubleLimb t = (DoubleLimb) a * b;
+            Limb m = (Limb) t * pInverse;
+            Limb u = (Limb) ((t + (DoubleLimb) m * p) >> LIMB_BITS);
+            return u >= p ? u - p : u;
+        }
+
+        Limb add(Limb a, Limb b) const {
+            Limb s = a + b;
+            return s >= p ? s - p : s;
+        }
+
+        Limb sub(Limb a, Limb b) const {
+            return a >= b ? a - b : a + p - b;
+        }
+
+        /**
+         * a mod p for any limb, p is more than a third of 2^64, so two subtractions are enough.
+         */
+        Limb reduce(Limb a) const {
+            a = a >= p ? a - p : a;
+            return a >= p ? a - p : a;
+        }
+
+        /**
+         * Conversion of any limb to the Montgomery form.
+         */
+        Limb toMontgomery(Limb a) const {
+            return mul(reduce(a), r2);
+        }
+
+        /**
+         * Conversion back from the Montgomery form.
+         */
+        Limb fromMontgomery(Limb a) const {
+            return mul(a, 1);
+        }
+
+        /**
+         * base^e, both in the Montgomery form.
+         */
+        Limb power(Limb base, Limb e) const {
+            Limb result = toMontgomery(1);
+            for (; e > 0; e >>= 1) {
+                if (e & 1) {
+                    result = mul(result, base);
+                }
+                base = mul(base, base);
+            }
+            return result;
+        }
+
+        /**
+         * a^-1 mod p in the Montgomery form, a is in the Montgomery form.
+         */
+        Limb inverse(Limb a) const {
+            return power(a, p - 2);
+        }
+    };
+
+    /**
+     * The three primes of the number-theoretic transform. A coefficient of the cyclic convolution of n limbs is less
+     * than n * 2^128, so their product (about 2^189) is enough for any realistic length.
+     */
+    static const NttPrime * nttPrimes() {
+        static const NttPrime primes[3] = {
+            NttPrime(0x7fe1000000000001ULL, 3),
+            NttPrime(0x7fb9000000000001ULL, 5),
+            NttPrime(0x7fb7000000000001ULL, 3)
+        };
+        return primes;
+    }
+
+    /**
+     * Number-theoretic transform of a[0..n) modulo the prime, n is a power of two. The forward transform takes the
+     * natural order and produces the bit-reversed order (decimation in frequency), the inverse transform goes back the
+     * other way (decimation in time) and leaves the result multiplied by n.
+     *
+     * The values are kept as they are, the roots of unity are in the Montgomery form, so they cancel out.
+     */
+    static void nttTransform(Limb * a, std::size_t n, const NttPrime & prime, bool inverse) {
+        if (n < 2) {
+            return;
+        }
+
+        // Powers of the primitive n-th root of unity (or its inverse).
+        Limb root = prime.power(prime.toMontgomery(prime.generator), (prime.p - 1) / n);
+        if (inverse) {
+            root = prime.inverse(root);
+        }
+        std::vector<Limb> roots(n / 2);
+        roots[0] = prime.toMontgomery(1);
+        for (std::size_t j = 1; j < n / 2; ++j) {
+            roots[j] = prime.mul(roots[j - 1], root);
+        }
+
+        if (!inverse) {
+            for (std::size_t len = n / 2; len >= 1; len /= 2) {
+                std::size_t stride = n / (2 * len);
+                for (std::size_t s = 0; s < n; s += 2 * len) {
+                    for (std::size_t j = 0; j < len; ++j) {
+                        Limb u = a[s + j];
+                        Limb v = a[s + j + len];
+                        a[s + j] = prime.add(u, v);
+                        a[s + j + len] = prime.mul(prime.sub(u, v), roots[j * stride]);
+                    }
+                }
+            }
+        } else {
+            for (std::size_t len = 1; len < n; len *= 2) {
+                std::size_t stride = n / (2 * len);
+                for (std::size_t s = 0; s < n; s += 2 * len) {
+                    for (std::size_t j = 0; j < len; ++j) {
+                        Limb u = a[s + j];
+                        Limb v = prime.mul(a[s + j + len], roots[j * stride]);
+                        a[s + j] = prime.add(u, v);
+                        a[s + j + len] = prime.sub(u, v);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * The cyclic convolution of a[0..an) and b[0..bn) modulo the prime, in c[0..n).
+     */
+    static void nttConvolution(Limb * c, std::size_t n, const Limb * a, std::size_t an, const Limb * b,
+                               std::size_t bn, const NttPrime & prime, Limb * tmp) {
+        // A square needs just one forward transform.
+        bool square = a == b && an == bn;
+        for (std::size_t i = 0; i < n; ++i) {
+            c[i] = (i < an) ? prime.reduce(a[i]) : 0;
+        }
+        nttTransform(c, n, prime, false);
+        if (square) {
+            tmp = c;
+        } else {
+            for (std::size_t i = 0; i < n; ++i) {
+                tmp[i] = (i < bn) ? prime.reduce(b[i]) : 0;
+            }
+            nttTransform(tmp, n, prime, false);
+        }
+
+        // Each product gets one factor R^-1, the inverse transform a factor n. Both are fixed by one multiplication.
+        for (std::size_t i = 0; i < n; ++i) {
+            c[i] = prime.mul(c[i], tmp[i]);
+        }
+        nttTransform(c, n, prime, true);
+        nttScale(c, n, prime);
+    }
+
+    /**
+     * Multiplies c[0..n) by R / n, it turns the values x * n / R after the inverse transform into x.
+     */
+    static void nttScale(Limb * c, std::size_t n, const NttPrime & prime) {
+        // mul(x, R^2 / n) = x * R / n
+        Limb nInverse = prime.inverse(prime.toMontgomery(n));
+        Limb scale = prime.mul(nInverse, prime.r2);
+        for (std::size_t i = 0; i < n; ++i) {
+            c[i] = prime.mul(c[i], scale);
+        }
+    }
+
+    /**
+     * Multiplication r[0..an+bn) = a[0..an) * b[0..bn) by the number-theoretic transform.
+     *
+     * Every limb is one coefficient of a polynomial, the product of the polynomials is computed modulo three primes
+     * with the transform and the exact coefficients are recovered by the Chinese remainder theorem (Garner's
+     * algorithm). Then the coefficients are added with the carries.
+     */
+    static void mulNtt(Limb * r, const Limb * a, std::size_t an, const Limb * b, std::size_t bn) {
+        std::size_t n = 1;
+        while (n < an + bn) {
+            n *= 2;
+        }
+
+        const NttPrime * primes = nttPrimes();
+        std::vector<Limb> residues(4 * n);
+        Limb * tmp = residues.data() + 3 * n;
+        for (int i = 0; i < 3; ++i) {
+            nttConvolution(residues.data() + i * n, n, a, an, b, bn, primes[i], tmp);
+        }
+
+        nttRecombine(r, an + bn, residues.data(), n);
+    }
+
+    /**
+     * Chinese remaindering of the coefficients given modulo the three primes (in c, c + n and c + 2n) and adding them
+     * up into r[0..rn).
+     */
+    static void nttRecombine(Limb * r, std::size_t rn, const Limb * c, std::size_t n) {
+        const NttPrime * primes = nttPrimes();
+        const NttPrime & p1 = primes[0];
+        const NttPrime & p2 = primes[1];
+        const NttPrime & p3 = primes[2];
+
+        // The constants of Garner's algorithm, in the Montgomery form so that mul(x, constant) = x * constant.
+        const Limb inverse12 = p2.inverse(p2.toMontgomery(p1.p));
+        const Limb inverse13 = p3.inverse(p3.toMontgomery(p1.p));
+        const Limb inverse23 = p3.inverse(p3.toMontgomery(p2.p));
+        const DoubleLimb p12 = (DoubleLimb) p1.p * p2.p;
+        const Limb p12Low = (Limb) p12;
+        const Limb p12High = (Limb) (p12 >> LIMB_BITS);
+
+        // The carry of three limbs.
+        Limb c0 = 0, c1 = 0, c2 = 0;
+        for (std::size_t i = 0; i < rn; ++i) {
+            if (i < n) {
+                Limb x1 = c[i];
+                Limb x2 = c[n + i];
+                Limb x3 = c[2 * n + i];
+
+                // x = x1 + p1 * t2 + p1 * p2 * t3
+                Limb t2 = p2.mul(p2.sub(x2, x1 >= p2.p ? x1 - p2.p : x1), inverse12);
+                Limb t3 = p3.mul(p3.sub(x3, x1 >= p3.p ? x1 - p3.p : x1), inverse13);
+                t3 = p3.mul(p3.sub(t3, t2 >= p3.p ? t2 - p3.p : t2), inverse23);
+
+                DoubleLimb low = (DoubleLimb) p1.p * t2 + x1;
+                DoubleLimb mid = (DoubleLimb) p12Low * t3;
+                DoubleLimb high = (DoubleLimb) p12High * t3;
+
+                // Add the x to the carry.
+                DoubleLimb sum = (DoubleLimb) c0 + (Limb) low + (Limb) mid;
+                c0 = (Limb) sum;
+                sum = (sum >> LIMB_BITS) + c1 + (Limb) (low >> LIMB_BITS) + (Limb) (mid >> LIMB_BITS) + (Limb) high;
+                c1 = (Limb) sum;
+                c2 += (Limb) (sum >> LIMB_BITS) + (Limb) (high >> LIMB_BITS);
+            }
+
+            r[i] = c0;
+            c0 = c1;
+            c1 = c2;
+            c2 = 0;
+        }
+    }
+
+    /**
+     * Evaluation of a2 * x^2 + a1 * x + a0 in 1, -1 and -2 for Toom-Cook. The results have k + 1 limbs, for -1 and -2
+     * we get the absolute value and the sign. tmp must have room for k + 1 limbs.
+     */
+    static void evaluateToom3(const Limb * a, std::size_t k, std::size_t h, Limb * p1, Limb * pm1, Limb * pm2,
+                              bool & pm1Negative, bool & pm2Negative, Limb * tmp) {
+        const Limb * a0 = a;
+        const Limb * a1 = a + k;
+        const Limb * a2 = a + 2 * k;
+
+        // a0 + a2 and then +- a1.
+        tmp[k] = addLimbs(tmp, a0, k, a2, h);
+        pm1Negative = absDiffLimbs(pm1, tmp, k + 1, a1, k);
+        addLimbs(p1, tmp, k + 1, a1, k);
+
+        // (a0 + 4 * a2) - 2 * a1.
+        std::fill(tmp, tmp + k + 1, 0);
+        tmp[h] = shiftLeftLimbs(tmp, a2, h, 2);
+        addLimbs(tmp, tmp, k + 1, a0, k);
+        pm2[k] = shiftLeftLimbs(pm2, a1, k, 1);
+        pm2Negative = absDiffLimbs(pm2, tmp, k + 1, pm2, k + 1);
+    }
+
+    /**
+     * r[0..w) = x[0..xn) * y[0..yn) in twos complement, negated if negative is true.
+     */
+    static void signedProduct(Limb * r, std::size_t w, const Limb * x, std::size_t xn, const Limb * y,
+                              std::size_t yn, bool negative) {
+        if (xn == 0 || yn == 0) {
+            std::fill(r, r + w, 0);
+            return;
+        }
+        mulLimbs(r, x, xn, y, yn);
+        std::fill(r + xn + yn, r + w, 0);
+        if (negative) {
+            // Complement and add one.
+            Limb carry = 1;
+            for (std::size_t i = 0; i < w; ++i) {
+                r[i] = ~r[i] + carry;
+                carry = carry && r[i] == 0;
+            }
+        }
+    }
+
+    /**
+     * r[0..n) = a[0..n) << s for 0 < s < 64, returns the bits shifted out. r can be the same array as a.
+     */
+    static Limb shiftLeftLimbs(Limb * r, const Limb * a, std::size_t n, unsigned s) {
+        Limb out = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            Limb value = a[i];
+            r[i] = (value << s) | out;
+            out = value >> (LIMB_BITS - s);
+        }
+        return out;
+    }
+
+    /**
+     * Arithmetic shift of the twos complement a[0..n) to the right by 0 < s < 64 bits.
+     */
+    static void shiftRightSigned(Limb * a, std::size_t n, unsigned s) {
+        Limb high = (a[n - 1] >> (LIMB_BITS - 1)) ? ~(Limb) 0 : 0;
+        for (std::size_t i = n - 1; i != (std::size_t) -1; --i) {
+            Limb value = a[i];
+            a[i] = (value >> s) | (high << (LIMB_BITS - s));
+            high = value;
+        }
+    }
+
+    /**
+     * Exact division q[0..n) = a[0..n) / d by an odd d which is known to divide a. q can be the same array as a.
+     *
+     * Instead of dividing we multiply by the inverse of d modulo 2^64 - one multiplication per limb. It works modulo
+     * B^n, so also for the twos complement of negative numbers.
+     */
+    static void divExactLimbs(Limb * q, const Limb * a, std::size_t n, Limb d) {
+        // Inverse modulo 2^64 by Newton's iteration, every step doubles the number of correct bits.
+        Limb inverse = d;
+        for (int i = 0; i < 5; ++i) {
+            inverse *= 2 - d * inverse;
+        }
+
+        Limb borrow = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            Limb s = a[i];
+            Limb l = s - borrow;
+            borrow = l > s;
+            Limb value = l * inverse;
+            q[i] = value;
+            borrow += (Limb) (((DoubleLimb) value * d) >> LIMB_BITS);
+        }
+    }
+
+    /**
+     * r[0..n) -= a[0..n) * b, returns the borrow limb.
+     */
+    static Limb subMulLimb(Limb * r, const Limb * a, std::size_t n, Limb b) {
+        Limb borrow = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            DoubleLimb t = (DoubleLimb) a[i] * b + borrow;
+            Limb low = (Limb) t;
+            borrow = (Limb) (t >> LIMB_BITS) + (r[i] < low);
+            r[i] -= low;
+        }
+        return borrow;
+    }
+
+    /**
+     * Long division q[0..an-bn+1) = a[0..an) / b[0..bn), r[0..bn) = a[0..an) % b[0..bn) for an >= bn and
+     * b[bn - 1] != 0 (Knuth's Algorithm D).
+     *
+     * The divisor is shifted so that its highest bit is set. Then the estimate of a quotient limb from the two
+     * highest limbs of the remainder and the highest limb of the divisor is corrected with the second limb of the
+     * divisor, after that it is at most one too large - which is fixed by adding the divisor back.
+     */
+    static void divRemLimbs(Limb * q, Limb * r, const Limb * a, std::size_t an, const Limb * b, std::size_t bn) {
+        if (bn == 1) {
+            r[0] = divRemLimb(q, a, an, b[0]);
+            return;
+        }
+
+        unsigned s = LIMB_BITS - limbBitLength(b[bn - 1]);
+        std::vector<Limb> v(bn);
+        std::vector<Limb> u(an + 1);
+        if (s != 0) {
+            shiftLeftLimbs(v.data(), b, bn, s);
+            u[an] = shiftLeftLimbs(u.data(), a, an, s);
+        } else {
+            std::copy(b, b + bn, v.begin());
+            std::copy(a, a + an, u.begin());
+        }
+
+        const Limb vHigh = v[bn - 1];
+        const Limb vNext = v[bn - 2];
+        for (std::size_t j = an - bn; j != (std::size_t) -1; --j) {
+            // The estimate from the top two limbs, it is never too small.
+            DoubleLimb top = ((DoubleLimb) u[j + bn] << LIMB_BITS) | u[j + bn - 1];
+            DoubleLimb qHat = top / vHigh;
+            DoubleLimb rHat = top % vHigh;
+            while ((qHat >> LIMB_BITS) != 0 || qHat * vNext > ((rHat << LIMB_BITS) | u[j + bn - 2])) {
+                --qHat;
+                rHat += vHigh;
+                if ((rHat >> LIMB_BITS) != 0) {
+                    break;
+                }
+            }
+
+            // Subtract qHat * v, if it was too much add v back.
+            Limb borrow = subMulLimb(u.data() + j, v.data(), bn, (Limb) qHat);
+            Limb high = u[j + bn];
+            u[j + bn] = high - borrow;
+            if (high < borrow) {
+                --qHat;
+                u[j + bn] += addLimbs(u.data() + j, u.data() + j, bn, v.data(), bn);
+            }
+            q[j] = (Limb) qHat;
+        }
+
+        // The remainder is shifted back.
+        for (std::size_t i = 0; i < bn; ++i) {
+            r[i] = (s != 0) ? (u[i] >> s) | (u[i + 1] << (LIMB_BITS - s)) : u[i];
+        }
+    }
+
+    /**
+     * Division with the remainder q = a / b, r = a % b of a >= 0 by b > 0 with Algorithm D.
+     */
+    static void divRemKnuth(const BigInteger & a, const BigInteger & b, BigInteger & q, BigInteger & r) {
+        if (a.compare(b) < 0) {
+            r = a;
+            q.setLength(0);
+            q.positive = true;
+            return;
+        }
+
+        // The results go right into the buffers of q and r, unless they are the operands as well.
+        if (&q == &a || &q == &b || &r == &a || &r == &b) {
+            BigInteger quotient(0);
+            BigInteger remainder(0);
+            divRemKnuth(a, b, quotient, remainder);
+            q.swap(quotient);
+            r.swap(remainder);
+            return;
+        }
+
+        q.setLength(a.length - b.length + 1);
+        r.setLength(b.length);
+        q.positive = true;
+        r.positive = true;
+        divRemLimbs(q.digits, r.digits, a.digits, a.length, b.digits, b.length);
+        q.normalize();
+        r.normalize();
+    }
+
+    /**
+     * Division with the remainder q = a / b, r = a % b of a >= 0 by b > 0, the algorithm is chosen by the lengths.
+     */
+    static void divRem(const BigInteger & a, const BigInteger & b, BigInteger & q, BigInteger & r) {
+        // Large divisors with long quotients by the recursive algorithm, the rest by the long division.
+        const std::size_t threshold = thresholds().burnikelZiegler;
+        if (b.length >= threshold && a.length >= b.length + threshold) {
+            divRemBurnikelZiegler(a, b, q, r);
+        } else {
+            divRemKnuth(a, b, q, r);
+        }
+    }
+
+    /**
+     * The number made of the limbs [from, from + count) of a non-negative x.
+     */
+    static BigInteger limbSlice(const BigInteger & x, std::size_t from, std::size_t count) {
+        BigInteger result(0);
+        if (from < x.length) {
+            count = std::min(count, x.length - from);
+            result.setLength(count);
+            std::copy(x.digits + from, x.digits + from + count, result.digits);
+            result.normalize();
+        }
+        return result;
+    }
+
+    /**
+     * Division with the remainder q = a / b, r = a % b of a >= 0 by b > 0 by the recursive algorithm of Burnikel and
+     * Ziegler.
+     *
+     * The divisor is shifted to exactly n = j * 2^k limbs with the highest bit set (j below the threshold, so the
+     * recursion can halve n k times). The dividend is cut into blocks of n limbs and divided by two blocks at a time
+     * with div2n1n, like a long division with the digits base B^n.
+     */
+    static void divRemBurnikelZiegler(const BigInteger & a, const BigInteger & b, BigInteger & q, BigInteger & r) {
+        std::size_t threshold = std::max(thresholds().burnikelZiegler, (std::size_t) 2);
+        std::size_t blocks = 1;
+        while (blocks * threshold <= b.length) {
+            blocks *= 2;
+        }
+        std::size_t n = (b.length + blocks - 1) / blocks * blocks;
+
+        std::size_t sigma = n * LIMB_BITS - b.getLength();
+        BigInteger bNorm(b);
+        BigInteger aNorm(a);
+        bNorm.shiftLeft(sigma);
+        aNorm.shiftLeft(sigma);
+
+        // The highest bit of the highest block is zero, so the block is less than b.
+        std::size_t t = std::max((std::size_t) 2, aNorm.getLength() / (n * LIMB_BITS) + 1);
+
+        BigInteger quotient(0);
+        BigInteger z = limbSlice(aNorm, (t - 2) * n, 2 * n);
+        for (std::size_t i = t - 2; i != (std::size_t) -1; --i) {
+            BigInteger qi, ri;
+            div2n1n(z, bNorm, n, qi, ri);
+            quotient.shiftLeft(n * LIMB_BITS);
+            quotient.add(qi);
+
+            if (i > 0) {
+                z.swap(ri);
+                z.shiftLeft(n * LIMB_BITS);
+                z.add(limbSlice(aNorm, (i - 1) * n, n));
+            } else {
+                r.swap(ri);
+            }
+        }
+
+        q.swap(quotient);
+        r.shiftRight(sigma);
+    }
+
+    /**
+     * Division of a < b * B^n by b of n limbs with the highest bit set. With n = 2h it is two divisions of 3h limbs
+     * by 2h limbs - the upper three quarters of a and then the remainder with the last quarter.
+     */
+    static void div2n1n(const BigInteger & a, const BigInteger & b, std::size_t n, BigInteger & q, BigInteger & r) {
+        if (n % 2 != 0 || n < thresholds().burnikelZiegler) {
+            divRemKnuth(a, b, q, r);
+            return;
+        }
+
+        std::size_t h = n / 2;
+        BigInteger b1 = limbSlice(b, h, h);
+        BigInteger b2 = limbSlice(b, 0, h);
+
+        BigInteger q1, r1, q2;
+        div3n2n(limbSlice(a, n, n), limbSlice(a, h, h), b, b1, b2, h, q1, r1);
+        div3n2n(r1, limbSlice(a, 0, h), b, b1, b2, h, q2, r);
+
+        q.swap(q1);
+        q.shiftLeft(h * LIMB_BITS);
+        q.add(q2);
+    }
+
+    /**
+     * Division of a = a12 * B^h + a3 by b = b1 * B^h + b2 (both halves have h limbs, b1 has the highest bit set and
+     * a12 < b * B^h). The quotient is estimated by the division of a12 by b1 and it is at most by two too large.
+     */
+    static void div3n2n(const BigInteger & a12, const BigInteger & a3, const BigInteger & b, const BigInteger & b1,
+                        const BigInteger & b2, std::size_t h, BigInteger & q, BigInteger & r) {
+        BigInteger r1;
+        if (limbSlice(a12, h, h).compare(b1) < 0) {
+            div2n1n(a12, b1, h, q, r1);
+        } else {
+            // q = B^h - 1 and r1 = a12 - q * b1 = a12 - b1 * B^h + b1.
+            q = power2(h * LIMB_BITS);
+            q.subtract(1);
+            r1 = b1;
+            r1.shiftLeft(h * LIMB_BITS);
+            r1.negate();
+            r1.add(a12);
+            r1.add(b1);
+        }
+
+        BigInteger d(q);
+        d.multiply(b2);
+        r.swap(r1);
+        r.shiftLeft(h * LIMB_BITS);
+        r.add(a3);
+        r.subtract(d);
+
+        while (!r.isNonNegative()) {
+            q.subtract(1);
+            r.add(b);
+        }
+    }
+
+    /**
+     * The largest power of the radix which fits into a limb, chunkDigits is set to its exponent.
+     */
+    static Limb chunkRadix(std::size_t radix, std::size_t & chunkDigits) {
+        Limb chunk = radix;
+        chunkDigits = 1;
+        while (chunk <= ~(Limb) 0 / radix) {
+            chunk *= radix;
+            ++chunkDigits;
+        }
+        return chunk;
+    }
+
+    /**
+     * The power c^(2^k) of the chunk radix c (see chunkRadix) - it has chunkDigits * 2^k digits zero in the radix.
+     *
+     * The powers are cached for every radix and reused by all the conversions. The cache is shared by the threads,
+     * the references stay valid when it grows.
+     */
+    static const BigInteger & radixPower(std::size_t radix, std::size_t k) {
+        static std::mutex mutex;
+        static std::map<std::size_t, std::deque<BigInteger> > cache;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // The cached powers outlive any arena, they take their arrays from the pool.
+        ResourceScope poolScope(0);
+        std::deque<BigInteger> & powers = cache[radix];
+        if (powers.empty()) {
+            std::size_t chunkDigits;
+            BigInteger chunk(0);
+            chunk.setLength(1);
+            chunk.digits[0] = chunkRadix(radix, chunkDigits);
+            powers.push_back(chunk);
+        }
+        while (powers.size() <= k) {
+            BigInteger next(powers.back());
+            next.square();
+            powers.push_back(next);
+        }
+        return powers[k];
+    }
+
+    /**
+     * Writes the digits of 0 <= x < radix^width in the radix into [end - width, end), padded by leading zeros. The
+     * digits are the values 0..radix-1, not characters.
+     *
+     * Divide and conquer - x is divided by a cached power of the radix with about half of its limbs, the quotient
+     * gives the upper digits and the remainder the lower ones (the number of them is known). Small numbers are
+     * divided by the chunk radix repeatedly. For very large numbers the halves are done in two threads.
+     */
+    template <class Digit>
+    static void writeDigits(const BigInteger & x, std::size_t radix, Digit * end, std::size_t width) {
+        std::size_t chunkDigits;
+        Limb chunk = chunkRadix(radix, chunkDigits);
+
+        if (x.length < std::max(thresholds().radixConversion, (std::size_t) 2)) {
+            std::vector<Limb> d(x.digits, x.digits + x.length);
+            std::size_t n = d.size();
+            Digit * begin = end - width;
+            while (end != begin) {
+                Limb c = 0;
+                if (n > 0) {
+                    c = divRemLimb(d.data(), d.data(), n, chunk);
+                    while (n > 0 && d[n - 1] == 0) {
+                        --n;
+                    }
+                }
+                for (std::size_t i = 0; i < chunkDigits && end != begin; ++i) {
+                    *--end = (Digit) (c % radix);
+                    c /= radix;
+                }
+            }
+            return;
+        }
+
+        // The largest cached power with at most half of the limbs of x.
+        std::size_t k = 0;
+        while (radixPower(radix, k + 1).length <= (x.length + 1) / 2) {
+            ++k;
+        }
+        std::size_t lowWidth = chunkDigits << k;
+
+        BigInteger q, r;
+        divRem(x, radixPower(radix, k), q, r);
+
+        if (x.length >= thresholds().parallelConversion) {
+            std::thread high([&]() {
+                writeDigits(q, radix, end - lowWidth, width - lowWidth);
+            });
+            writeDigits(r, radix, end, lowWidth);
+            high.join();
+        } else {
+            writeDigits(q, radix, end - lowWidth, width - lowWidth);
+            writeDigits(r, radix, end, lowWidth);
+        }
+    }
+
+    /**
+     * The value of the digit value[i] in the radix, throws an exception for an invalid character.
+     */
+    static Limb digitValue(const std::string & value, std::size_t i, std::size_t radix) {
+        char c = value[i];
+        std::size_t d = radix;
+        if (c >= '0' && c <= '9') {
+            d = c - '0';
+        } else if (c >= 'a' && c <= 'z') {
+            d = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'Z') {
+            d = c - 'A' + 10;
+        }
+
+        if (d >= radix) {
+            std::stringstream message;
+            message << "Invalid digit '" << c << "' at position " << i << " of \"" << value << "\" in radix " << radix
+                    << ".";
+            throw std::runtime_error(message.str());
+        }
+        return d;
+    }
+
+    /**
+     * The number with the digits chunks[0..count) in the base of the chunk radix (see chunkRadix), the most
+     * significant first.
+     *
+     * Divide and conquer - the lower 2^k chunks and the upper ones are converted separately and combined with the
+     * cached power of the radix. Short sequences are multiplied in limb by limb.
+     */
+    static BigInteger fromChunks(const Limb * chunks, std::size_t count, std::size_t radix) {
+        if (count < std::max(thresholds().radixConversion, (std::size_t) 2)) {
+            std::size_t chunkDigits;
+            Limb chunk = chunkRadix(radix, chunkDigits);
+
+            // r = r * chunk + chunks[i], the number has at most count limbs.
+            std::vector<Limb> r(count + 1, 0);
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < count; ++i) {
+                Limb carry = chunks[i];
+                for (std::size_t j = 0; j < n; ++j) {
+                    DoubleLimb t = (DoubleLimb) r[j] * chunk + carry;
+                    r[j] = (Limb) t;
+                    carry = (Limb) (t >> LIMB_BITS);
+                }
+                if (carry != 0) {
+                    r[n++] = carry;
+                }
+            }
+
+            BigInteger result(0);
+            result.setLength(n);
+            std::copy(r.begin(), r.begin() + n, result.digits);
+            result.normalize();
+            return result;
+        }
+
+        // The largest power of two less than count.
+        std::size_t k = 0;
+        while (((std::size_t) 2 << k) < count) {
+            ++k;
+        }
+        std::size_t low = (std::size_t) 1 << k;
+
+        BigInteger result = fromChunks(chunks, count - low, radix);
+        result.multiply(radixPower(radix, k));
+        result.add(fromChunks(chunks + count - low, low, radix));
+        return result;
+    }
+
+    /**
+     * An upper bound of the number of digits of a non-negative x in the radix.
+     */
+    static std::size_t digitBound(const BigInteger & x, std::size_t radix) {
+        return (std::size_t) (x.getLength() * std::log(2.0) / std::log((double) radix)) + 2;
+    }
+
+    /**
+     * Division by a single limb q[0..n) = a[0..n) / d, returns the remainder. q can be the same array as a.
+     */
+    static Limb divRemLimb(Limb * q, const Limb * a, std::size_t n, Limb d) {
+        Limb r = 0;
+        for (std::size_t i = n - 1; i != (std::size_t) -1; --i) {
+            DoubleLimb t = ((DoubleLimb) r << LIMB_BITS) | a[i];
+            q[i] = (Limb) (t / d);
+            r = (Limb) (t % d);
+        }
+        return r;
+    }
+
+    std::string rawBits(void) const {
+        std::stringstream str;
+        for (size_t i = length * LIMB_BITS - 1; i != (size_t) -1; --i) {
+            str << (testBit(i) ? 1 : 0);
+        }
+        return str.str();
+    }
+
+    /**
+     * The resource of the heap arrays of this number, 0 for the thread-local pool.
+     */
+    MemoryResource * resource;
+
+    /**
+     * Limb array - either the inline storage or an array on the heap.
+     */
+    Limb * digits;
+
+    /**
+     * Inline storage for small numbers.
+     */
+    Limb inlineDigits[INLINE_LIMBS];
+
+    /**
+     * Positivity flag.
+     */
+    bool positive;
+
+    /**
+     * Length of the number in limbs.
+     */
+    std::size_t length;
+
+    /**
+     * Number of limbs of the array, at least INLINE_LIMBS.
+     */
+    std::size_t capacity;
+};
+
+/**
+ * Result of the div and mod operation - we just implement them together.
+ */
+struct DivisionResult {
+    BigInteger quotient;
+    BigInteger remainder;
+};
+
+/**
+ * The read-only members of BigInteger for the expressions below, so (a * b).toString() or (a * b).isZero() still work.
+ * Every call evaluates the whole expression into a temporary BigInteger. Like everything else taking an expression
+ * they are only there for the temporary itself (&&), never for a stored expression.
+ */
+template <typename Expression>
+struct ExpressionValue {
+    BigInteger value(void) && {
+        return BigInteger(static_cast<Expression &&>(*this));
+    }
+
+    std::string toString(char radix = 10) && {
+        return std::move(*this).value().toString(radix);
+    }
+
+    std::vector<std::size_t> toRadix(std::size_t radix) && {
+        return std::move(*this).value().toRadix(radix);
+    }
+
+    std::size_t getLength() && {
+        return std::move(*this).value().getLength();
+    }
+
+    bool isNonNegative() && {
+        return std::move(*this).value().isNonNegative();
+    }
+
+    bool isZero(void) && {
+        return std::move(*this).value().isZero();
+    }
+
+    bool isEven(void) && {
+        return std::move(*this).value().isEven();
+    }
+
+    bool isOdd(void) && {
+        return std::move(*this).value().isOdd();
+    }
+
+    int compare(const BigInteger & b) && {
+        return std::move(*this).value().compare(b);
+    }
+
+    int intValue(void) && {
+        return std::move(*this).value().intValue();
+    }
+
+protected:
+    ExpressionValue() {}
+    ExpressionValue(const ExpressionValue &) {}
+};
+
+/**
+ * The product a * b, not computed yet. The expressions only keep references to the operands, so they must be used in
+ * the statement which creates them - assigned or converted to a BigInteger, never stored. Write `BigInteger p = a * b;`
+ * and not `auto p = a * b;`: only the operators can copy an expression, so up to C++14 the latter does not compile.
+ * C++17 does not copy there, p is declared - but the conversions, the operators and the members of ExpressionValue
+ * take only a temporary expression (&&), so p cannot be used anywhere.
+ *
+ * Besides the members of ExpressionValue the expression is not a BigInteger - templates deduce the expression type, so
+ * std::max(a * b, c) does not compile. Convert it there: std::max(BigInteger(a * b), c) or std::max<BigInteger>(...).
+ */
+struct ProductExpression: ExpressionValue<ProductExpression> {
+    friend ProductExpression operator*(const BigInteger & a, const BigInteger & b);
+
+    const BigInteger & a;
+    const BigInteger & b;
+
+private:
+    ProductExpression(const BigInteger & a, const BigInteger & b): a(a), b(b) {}
+    ProductExpression(const ProductExpression & e): ExpressionValue<ProductExpression>(e), a(e.a), b(e.b) {}
+};
+
+/**
+ * The modular product a * b % m.
+ */
+struct ProductModExpression: ExpressionValue<ProductModExpression> {
+    friend ProductModExpression operator%(ProductExpression && p, const BigInteger & m);
+
+    const BigInteger & a;
+    const BigInteger & b;
+    const BigInteger & m;
+
+private:
+    ProductModExpression(const BigInteger & a, const BigInteger & b, const BigInteger & m): a(a), b(b), m(m) {}
+    ProductModExpression(const ProductModExpression & e):
+        ExpressionValue<ProductModExpression>(e), a(e.a), b(e.b), m(e.m) {}
+};
+
+/**
+ * The sum c + a * b, or the difference c - a * b if subtract is set. The product is the temporary of the same
+ * statement, so a reference to it is enough.
+ */
+struct SumProductExpression: ExpressionValue<SumProductExpression> {
+    friend SumProductExpression operator+(const BigInteger & c, ProductExpression && p);
+    friend SumProductExpression operator+(ProductExpression && p, const BigInteger & c);
+    friend SumProductExpression operator-(const BigInteger & c, ProductExpression && p);
+
+    const BigInteger & c;
+    const ProductExpression & product;
+    bool subtract;
+
+private:
+    SumProductExpression(const BigInteger & c, const ProductExpression & product, bool subtract):
+        c(c), product(product), subtract(subtract) {}
+    SumProductExpression(const SumProductExpression & e):
+        ExpressionValue<SumProductExpression>(e), c(e.c), product(e.product), subtract(e.subtract) {}
+};
+
+BigInteger::BigInteger(ProductExpression && e):
+    resource(currentResource()),
+    digits(inlineDigits),
+    positive(true),
+    length(0),
+    capacity(INLINE_LIMBS) {
+    setProduct(e.a, e.b);
+}
+
+BigInteger::BigInteger(ProductModExpression && e):
+    resource(currentResource()),
+    digits(inlineDigits),
+    positive(true),
+    length(0),
+    capacity(INLINE_LIMBS) {
+    mulMod(e.a, e.b, e.m);
+}
+
+BigInteger::BigInteger(SumProductExpression && e):
+    resource(currentResource()),
+    digits(inlineDigits),
+    positive(true),
+    length(0),
+    capacity(INLINE_LIMBS) {
+    *this = std::move(e);
+}
+
+BigInteger & BigInteger::operator=(ProductExpression && e) {
+    return setProduct(e.a, e.b);
+}
+
+BigInteger & BigInteger::operator=(ProductModExpression && e) {
+    return mulMod(e.a, e.b, e.m);
+}
+
+BigInteger & BigInteger::operator=(SumProductExpression && e) {
+    // this = c + a * b would overwrite a or b before the product is added, so the sum is evaluated aside.
+    if (this == &e.product.a || this == &e.product.b) {
+        BigInteger sum(std::move(e));
+        return swap(sum);
+    }
+
+    if (this != &e.c) {
+        *this = e.c;
+    }
+    return e.subtract ? subMul(e.product.a, e.product.b) : addMul(e.product.a, e.product.b);
+}
+
+/**
+ * Division and modulo by the long division of Knuth (Algorithm D) - one limb of the quotient in every step, or for
+ * large numbers by the recursive division of Burnikel and Ziegler which uses the fast multiplication.
+ *
+ * Just for a >= 0, b > 0.
+ */
+void divideAndMod(const BigInteger & a, const BigInteger & b, DivisionResult & res) {
+
+    // We do not know ho to divide by zero.
+    if (b.isZero()) {
+        throw std::runtime_error("Division by zero.");
+    }
+
+    BigInteger::divRem(a, b, res.quotient, res.remainder);
+}
+
+/**
+ * Division with the remainder of any numbers, b != 0.
+ *
+ * The quotient is rounded towards zero (as by divide) and the remainder has the sign of a, so a = quotient * b +
+ * remainder. Both come from a single division.
+ */
+DivisionResult divmod(const BigInteger & a, const BigInteger & b) {
+    DivisionResult res;
+    if (a.isNonNegative() && b.isNonNegative()) {
+        divideAndMod(a, b, res);
+        return res;
+    }
+
+    BigInteger aAbs(a);
+    BigInteger bAbs(b);
+    aAbs.abs();
+    bAbs.abs();
+    divideAndMod(aAbs, bAbs, res);
+
+    if (a.isNonNegative() != b.isNonNegative()) {
+        res.quotient.negate();
+    }
+    if (!a.isNonNegative()) {
+        res.remainder.negate();
+    }
+    return res;
+}
+
+/**
+ * Modulo operation.
+ *
+ * this becomes this % b.
+ */
+BigInteger& BigInteger::mod(const BigInteger & b) {
+    DivisionResult res = divmod(*this, b);
+    swap(res.remainder);
+
+    // The remainder of divmod has the sign of this, but a % b has the sign of b.
+    if (!isZero() && positive != b.positive) {
+        add(b);
+    }
+    return *this;
+}
+
+/**
+ * Division operation.
+ *
+ * this becomes this / b.
+ */
+BigInteger& BigInteger::divide(const BigInteger & b) {
+    DivisionResult res = divmod(*this, b);
+    swap(res.quotient);
+    return *this;
+}
+
+/**
+ * Precomputed values for the Montgomery multiplication modulo an odd m > 0.
+ *
+ * With R = 2^(64n), where n is the number of limbs of m, the number x is represented by xR mod m (the Montgomery
+ * form). The product of two such numbers is reduced by the division by R - just shifts - instead of the division by m:
+ * mulMont(xR, yR) = xyR mod m. So a computation with many multiplications modulo the same m converts the inputs
+ * with toMont, does all the work with mulMont/sqrMont and converts the result back with fromMont.
+ */
+class MontgomeryContext {
+public:
+    typedef BigInteger::Limb Limb;
+
+    /**
+     * Creation of the context for the modulus m, throws an exception if m is not odd and positive.
+     */
+    explicit MontgomeryContext(const BigInteger & m):
+        modulus(m),
+        n(m.length),
+        mInverse(0),
+        rModM(0),
+        r2(0) {
+        if (!m.positive || m.isEven()) {
+            throw std::runtime_error("Montgomery multiplication needs an odd positive modulus.");
+        }
+
+        // Newton's iteration for m^-1 mod 2^64, every step doubles the number of correct bits.
+        Limb inverse = m.digits[0];
+        for (int i = 0; i < 5; ++i) {
+            inverse *= 2 - m.digits[0] * inverse;
+        }
+        mInverse = -inverse;
+
+        // The only two divisions by m.
+        rModM = BigInteger::power2(n * BigInteger::LIMB_BITS);
+        rModM.mod(m);
+        r2 = BigInteger::power2(2 * n * BigInteger::LIMB_BITS);
+        r2.mod(m);
+    }
+
+    /**
+     * The modulus m.
+     */
+    const BigInteger & getModulus() const {
+        return modulus;
+    }
+
+    /**
+     * Number of limbs of m (and of all the numbers in the Montgomery form).
+     */
+    std::size_t size() const {
+        return n;
+    }
+
+    /**
+     * The number 1 in the Montgomery form (R mod m).
+     */
+    const BigInteger & one() const {
+        return rModM;
+    }
+
+    /**
+     * Conversion of any a to the Montgomery form aR mod m.
+     */
+    BigInteger toMont(const BigInteger & a) const {
+        BigInteger aMod(a);
+        aMod.mod(modulus);
+        return mulMont(aMod, r2);
+    }
+
+    /**
+     * Conversion of 0 <= a < m from the Montgomery form, gives a / R mod m.
+     */
+    BigInteger fromMont(const BigInteger & a) const {
+        return mulMont(a, BigInteger(1));
+    }
+
+    /**
+     * Montgomery product abR^-1 mod m of 0 <= a, b < m.
+     */
+    BigInteger mulMont(const BigInteger & a, const BigInteger & b) const {
+        std::vector<Limb> x(limbs(a)), y(limbs(b)), t(2 * n + 1);
+        mulMont(x.data(), x.data(), y.data(), t.data());
+        return fromLimbs(x.data());
+    }
+
+    /**
+     * Montgomery square a^2R^-1 mod m of 0 <= a < m.
+     */
+    BigInteger sqrMont(const BigInteger & a) const {
+        std::vector<Limb> x(limbs(a)), t(2 * n + 1);
+        sqrMont(x.data(), x.data(), t.data());
+        return fromLimbs(x.data());
+    }
+
+    /**
+     * The Montgomery product on the limb level r[0..n) = a[0..n) * b[0..n) / R mod m, t is the scratch space of
+     * 2n + 1 limbs. r can be the same array as a or b.
+     */
+    void mulMont(Limb * r, const Limb * a, const Limb * b, Limb * t) const {
+        BigInteger::mulLimbs(t, a, n, b, n);
+        reduce(r, t);
+    }
+
+    /**
+     * The Montgomery square on the limb level r[0..n) = a[0..n)^2 / R mod m, t is the scratch space of 2n + 1 limbs.
+     * r can be the same array as a.
+     */
+    void sqrMont(Limb * r, const Limb * a, Limb * t) const {
+        BigInteger::sqrLimbs(t, a, n);
+        reduce(r, t);
+    }
+
+    /**
+     * mulMont with a running time independent of the values - the schoolbook product and a reduction without any
+     * branches.
+     */
+    void mulMontConstTime(Limb * r, const Limb * a, const Limb * b, Limb * t) const {
+        BigInteger::mulBasecase(t, a, n, b, n);
+        reduceConstTime(r, t);
+    }
+
+    /**
+     * sqrMont with a running time independent of the values.
+     */
+    void sqrMontConstTime(Limb * r, const Limb * a, Limb * t) const {
+        BigInteger::sqrBasecase(t, a, n);
+        reduceConstTime(r, t);
+    }
+
+    /**
+     * Conversion of 0 <= a < m to an array of exactly n limbs.
+     */
+    std::vector<Limb> limbs(const BigInteger & a) const {
+        std::vector<Limb> result(n, 0);
+        std::copy(a.digits, a.digits + std::min(a.length, n), result.begin());
+        return result;
+    }
+
+    /**
+     * Conversion of an array of n limbs to a number.
+     */
+    BigInteger fromLimbs(const Limb * a) const {
+        BigInteger result(0);
+        result.setLength(n);
+        std::copy(a, a + n, result.digits);
+        result.normalize();
+        return result;
+    }
+
+private:
+    /**
+     * Montgomery reduction (REDC) r[0..n) = t[0..2n) / R mod m for t < mR, t[2n] is used for the carry.
+     *
+     * Adding a multiple of m which clears the lowest limb, n times, makes t divisible by R. The result t / R is less
+     * than 2m, so one subtraction of m is enough.
+     */
+    void reduce(Limb * r, Limb * t) const {
+        const Limb * m = modulus.digits;
+        t[2 * n] = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            Limb u = t[i] * mInverse;
+            Limb carry = BigInteger::addMulLimb(t + i, m, n, u);
+            for (std::size_t j = i + n; carry != 0; ++j) {
+                t[j] += carry;
+                carry = t[j] < carry;
+            }
+        }
+
+        if (t[2 * n] != 0 || BigInteger::compareLimbs(t + n, n, m, n) >= 0) {
+            BigInteger::subLimbs(r, t + n, n, m, n);
+        } else {
+            std::copy(t + n, t + 2 * n, r);
         }
-        return str.str();
     }
 
     /**
-     * Digit array.
+     * The same as reduce, but the carries always go up to the top and the final subtraction is always computed and
+     * selected by a mask.
      */
-    char * digits;
+    void reduceConstTime(Limb * r, Limb * t) const {
+        const Limb * m = modulus.digits;
+        t[2 * n] = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            Limb u = t[i] * mInverse;
+            Limb carry = BigInteger::addMulLimb(t + i, m, n, u);
+            for (std::size_t j = i + n; j <= 2 * n; ++j) {
+                t[j] += carry;
+                carry = t[j] < carry;
+            }
+        }
+
+        // Keep t - m unless it is negative.
+        Limb borrow = BigInteger::subLimbs(r, t + n, n, m, n);
+        Limb mask = -(t[2 * n] | (borrow ^ 1));
+        for (std::size_t i = 0; i < n; ++i) {
+            r[i] = (r[i] & mask) | (t[n + i] & ~mask);
+        }
+    }
 
     /**
-     * Positivity flag.
+     * The modulus.
      */
-    bool positive;
+    BigInteger modulus;
 
     /**
-     * Length of the number.
+     * Number of limbs of the modulus.
      */
-    std::size_t length;
-};
+    std::size_t n;
 
-/**
- * Result of the div and mod operation - we just implement them together.
- */
-struct DivisionResult {
-    BigInteger quotient;
-    BigInteger remainder;
+    /**
+     * -m^-1 mod 2^64.
+     */
+    Limb mInverse;
+
+    /**
+     * R mod m.
+     */
+    BigInteger rModM;
+
+    /**
+     * R^2 mod m, for the conversion to the Montgomery form.
+     */
+    BigInteger r2;
 };
 
 /**
- * Division and modulo according to the Algorithms textbook.
+ * Precomputed values for the Barrett reduction modulo any m > 0.
  *
- * Just for a >= 0, b > 0.
+ * With B = 2^64 and n the number of limbs of m we precompute mu = B^2n / m once. Then for 0 <= x < B^2n the
+ * quotient x / m is estimated as ((x / B^(n-1)) * mu) / B^(n+1), which is at most by two smaller than the exact one.
+ * So x mod m costs two multiplications, two shifts and at most two subtractions instead of a division.
  */
-void divideAndMod(BigInteger & a, const BigInteger & b, DivisionResult & res) {
+class BarrettContext {
+public:
+    /**
+     * Creation of the context for the modulus m, throws an exception if m is not positive.
+     */
+    explicit BarrettContext(const BigInteger & m):
+        modulus(m),
+        n(0),
+        mu(0) {
+        if (m.compare(BigInteger(0)) <= 0) {
+            throw std::runtime_error("Barrett reduction needs a positive modulus.");
+        }
 
-    // We do not know ho to divide by zero.
-    if (b.isZero()) {
-        throw std::runtime_error("Division by zero.");
+        n = (m.getLength() + BigInteger::LIMB_BITS - 1) / BigInteger::LIMB_BITS;
+
+        // The only division by m.
+        mu = BigInteger::power2(2 * n * BigInteger::LIMB_BITS);
+        mu.divide(m);
     }
 
-    // This is the basic case - 0/x = 0x + 0.
-    if (a.isZero()) {
-        res.remainder = BigInteger(0);
-        res.quotient = BigInteger(0);
+    /**
+     * The modulus m.
+     */
+    const BigInteger & getModulus() const {
+        return modulus;
+    }
 
-    } else {
-        // We divide by two.
-        bool odd = a.isOdd();
+    /**
+     * x mod m. Numbers out of the range 0 <= x < B^2n (which covers all products of two numbers less than m) fall
+     * back to the ordinary mod.
+     */
+    BigInteger reduce(const BigInteger & x) const {
+        BigInteger r(x);
+        if (!r.isNonNegative() || r.getLength() > 2 * n * BigInteger::LIMB_BITS) {
+            r.mod(modulus);
+            return r;
+        }
 
+        // The estimate of the quotient.
+        BigInteger q(x);
+        q.shiftRight((n - 1) * BigInteger::LIMB_BITS);
+        q.multiply(mu);
+        q.shiftRight((n + 1) * BigInteger::LIMB_BITS);
+
+        // The remainder, the estimate was too small by at most two.
+        q.multiply(modulus);
+        r.subtract(q);
+        while (r.compare(modulus) >= 0) {
+            r.subtract(modulus);
+        }
+        return r;
+    }
 
-        // "Divide" by two and compute the result.
-        a.shiftRight(1);
+private:
+    /**
+     * The modulus.
+     */
+    BigInteger modulus;
 
-        divideAndMod(a, b, res);
+    /**
+     * Number of limbs of the modulus.
+     */
+    std::size_t n;
 
+    /**
+     * B^2n / m.
+     */
+    BigInteger mu;
+};
 
-        // Back multiply by two.
-        res.quotient.shiftLeft(1);
-        res.remainder.shiftLeft(1);
+/**
+ * The operations of powerMod with the Montgomery multiplication, the numbers are arrays of a fixed length.
+ */
+struct MontgomeryOperations {
+    const MontgomeryContext & context;
+    std::vector<BigInteger::Limb> t;
 
+    explicit MontgomeryOperations(const MontgomeryContext & c):
+        context(c),
+        t(2 * c.size() + 1) {
+    }
 
-        // Do not forget adding the remainder if a was odd.
-        if (odd) {
-            res.remainder.add(1);
-        }
+    void square(std::vector<BigInteger::Limb> & x) {
+        context.sqrMont(x.data(), x.data(), t.data());
+    }
 
-        // If the remainder is large - add one to the quotient.
-        if (res.remainder.compare(b) >= 0) {
-            res.remainder.subtract(b);
-            res.quotient.add(BigInteger(1));
-        }
+    void multiply(std::vector<BigInteger::Limb> & x, const std::vector<BigInteger::Limb> & y) {
+        context.mulMont(x.data(), x.data(), y.data(), t.data());
+    }
+};
+
+/**
+ * The operations of powerMod with the Barrett reduction.
+ */
+struct BarrettOperations {
+    const BarrettContext & context;
 
+    explicit BarrettOperations(const BarrettContext & c):
+        context(c) {
     }
-}
+
+    void square(BigInteger & x) {
+        x.square();
+        x = context.reduce(x);
+    }
+
+    void multiply(BigInteger & x, const BigInteger & y) {
+        x.multiply(y);
+        x = context.reduce(x);
+    }
+};
 
 /**
- * Modulo operation.
- *
- * this becomes this % b.
+ * The operations of powerMod with the ordinary mod.
  */
-BigInteger& BigInteger::mod(const BigInteger & b) {
-    // If b is negative, then a % b = a % (-b) + b if a % (-b) > 0, and a % (-b) otherwise
-    if (!b.positive) {
-        BigInteger bAbs(b);
-        bAbs.negate();
+struct ModOperations {
+    const BigInteger & m;
 
-        mod(bAbs);
-        if(compare(BigInteger(0)) != 0) {
-            add(b);
-        }
+    explicit ModOperations(const BigInteger & modulus):
+        m(modulus) {
+    }
+
+    void square(BigInteger & x) {
+        x.square();
+        x.mod(m);
+    }
+
+    void multiply(BigInteger & x, const BigInteger & y) {
+        x.multiply(y);
+        x.mod(m);
+    }
+};
+
+BigInteger& BigInteger::powerMod(BigInteger k, const BigInteger & m, std::size_t window) {
+    if (!k.positive) {
+        throw std::runtime_error("Can only power to a non-negative number.");
+    }
+
+    // Odd modulus - no divisions in the loop, the numbers stay in the Montgomery form in arrays of a fixed length.
+    if (m.positive && m.isOdd()) {
+        MontgomeryContext context(m);
+        std::vector<Limb> base(context.limbs(context.toMont(*this)));
+        std::vector<Limb> result(context.limbs(context.one()));
+
+        MontgomeryOperations operations(context);
+        powerWindow(result, base, k, window, operations);
+
+        BigInteger power = context.fromMont(context.fromLimbs(result.data()));
+        swap(power);
         return *this;
     }
 
-    // If a is negative, then a % b = (b - (-a % b)) % b if -a % b > 0, and -a % b otherwise
-    if (!positive) {
-        BigInteger abs(*this);
-        abs.negate();
+    // Even modulus - the Barrett reduction, the base is reduced first so that all the products are less than m^2.
+    if (m.positive && !m.isZero()) {
+        BarrettContext context(m);
+        BigInteger base(*this);
+        base.mod(m);
 
-        abs.mod(b);
-        if(abs.compare(BigInteger(0)) != 0) {
-            abs.negate();
-            abs.add(b);
-        }
-        swap(abs);
+        BigInteger result = 1;
+        BarrettOperations operations(context);
+        powerWindow(result, base, k, window, operations);
 
+        swap(result);
         return *this;
     }
 
-    DivisionResult res;
-    divideAndMod(*this, b, res);
-    swap(res.remainder);
+    // Any other modulus - the ordinary mod, the base is reduced too. The table starts with the base, so for k = 1 it
+    // would be the result unreduced. For k = 0 the result is 1 without any mod, as before.
+    BigInteger base(*this);
+    if (!k.isZero()) {
+        base.mod(m);
+    }
+
+    BigInteger result = 1;
+    ModOperations operations(m);
+    powerWindow(result, base, k, window, operations);
+
+    swap(result);
+    return *this;
+}
+
+BigInteger& BigInteger::powerModConstTime(BigInteger k, const BigInteger & m) {
+    if (!k.positive) {
+        throw std::runtime_error("Can only power to a non-negative number.");
+    }
+
+    MontgomeryContext context(m);
+    std::size_t n = context.size();
+    std::vector<Limb> r0(context.limbs(context.one()));
+    std::vector<Limb> r1(context.limbs(context.toMont(*this)));
+    std::vector<Limb> t(2 * n + 1);
+
+    // The invariant is r1 = r0 * this, r0 is this to the bits of k processed so far. A one bit makes
+    // (r0, r1) = (r0 * r1, r1^2), a zero bit (r0^2, r0 * r1) - the same with the roles swapped.
+    Limb swapped = 0;
+    std::size_t bits = std::max(k.length, n) * LIMB_BITS;
+    for (std::size_t i = bits - 1; i != (std::size_t) -1; --i) {
+        Limb bit = (i / LIMB_BITS < k.length) ? (k.digits[i / LIMB_BITS] >> (i % LIMB_BITS)) & 1 : 0;
+        conditionalSwap(r0.data(), r1.data(), n, bit ^ swapped);
+        swapped = bit;
+
+        context.mulMontConstTime(r1.data(), r0.data(), r1.data(), t.data());
+        context.sqrMontConstTime(r0.data(), r0.data(), t.data());
+    }
+    conditionalSwap(r0.data(), r1.data(), n, swapped);
+
+    // Back from the Montgomery form, a multiplication by 1.
+    std::vector<Limb> one(n, 0);
+    one[0] = 1;
+    context.mulMontConstTime(r0.data(), r0.data(), one.data(), t.data());
+
+    BigInteger power = context.fromLimbs(r0.data());
+    swap(power);
     return *this;
 }
 
 /**
- * Division operation.
+ * A fixed number of threads running batches of independent tasks.
  *
- * this becomes this / b.
+ * Every thread has its own deque of the tasks, a batch is dealt out to them round-robin. A thread takes the tasks from
+ * the back of its own deque and, when it is empty, steals them from the front of the others - so the threads with the
+ * short tasks help the ones with the long tasks and all of them finish at about the same time. Each deque has its own
+ * lock, which is held only while a task index is taken out.
  */
-BigInteger& BigInteger::divide(const BigInteger & b) {
-    // When b is not positive - negate, divide and negate back.
-    if (!b.positive) {
-        BigInteger bAbs(b);
-        bAbs.negate();
+class WorkStealingPool {
+public:
+    /**
+     * Starts the threads, 0 means one thread per hardware thread.
+     */
+    explicit WorkStealingPool(unsigned threads = 0):
+        task(0),
+        remaining(0),
+        generation(0),
+        stopping(false) {
+        if (threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.push_back(std::thread(&WorkStealingPool::work, this, i));
+        }
+    }
 
-        divide(bAbs);
-        negate();
-        return *this;
+    /**
+     * Lets the threads finish and waits for them.
+     */
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
     }
 
-    // When this is not positive - negate, divide and negate back.
-    if (!positive) {
-        BigInteger abs(*this);
-        abs.negate();
+    /**
+     * Number of the threads.
+     */
+    std::size_t size() const {
+        return workers.size();
+    }
 
-        abs.divide(b);
-        abs.negate();
-        swap(abs);
-        return *this;
+    /**
+     * Runs f(i) for every i from 0 to count - 1 on the threads and returns when all of them are done. The first
+     * exception thrown by a task is thrown here, after the other tasks are finished. Only one thread at a time may
+     * run a batch.
+     */
+    void run(std::size_t count, const std::function<void(std::size_t)> & f) {
+        if (count == 0) {
+            return;
+        }
+
+        // The task is published before the indices, a thread finding an index finds the task too.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &f;
+            remaining = count;
+            error = std::exception_ptr();
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            Queue & queue = *queues[i % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(i);
+        }
+
+        // The new generation only after all the indices - a thread seeing it while the indices are pushed would find
+        // the deques empty and wait for the next generation, with nobody left to run the rest of this batch.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++generation;
+        }
+        wake.notify_all();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return remaining == 0; });
+        task = 0;
+        if (error) {
+            std::rethrow_exception(error);
+        }
     }
 
-    // Do the division.
-    DivisionResult res;
-    divideAndMod(*this, b, res);
-    swap(res.quotient);
-    return *this;
+private:
+    /**
+     * The tasks of one thread.
+     */
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    /**
+     * The loop of the thread id - waits for a batch and runs the tasks until there are none left in any deque.
+     */
+    void work(std::size_t id) {
+        std::size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+            }
+
+            std::size_t i;
+            while (take(id, i)) {
+                try {
+                    (*task)(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+                if (--remaining == 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done.notify_all();
+                }
+            }
+        }
+    }
+
+    /**
+     * The next task of the thread id, from the back of its own deque or stolen from the front of another one.
+     */
+    bool take(std::size_t id, std::size_t & i) {
+        for (std::size_t k = 0; k < queues.size(); ++k) {
+            Queue & queue = *queues[(id + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                if (k == 0) {
+                    i = queue.tasks.back();
+                    queue.tasks.pop_back();
+                } else {
+                    i = queue.tasks.front();
+                    queue.tasks.pop_front();
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * The deques of the threads.
+     */
+    std::vector<std::unique_ptr<Queue> > queues;
+
+    /**
+     * The threads.
+     */
+    std::vector<std::thread> workers;
+
+    /**
+     * Guards the batch state below, wake signals a new batch (or the end), done the end of a batch.
+     */
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    /**
+     * The function of the current batch.
+     */
+    const std::function<void(std::size_t)> * task;
+
+    /**
+     * Number of the tasks of the batch not finished yet.
+     */
+    std::atomic<std::size_t> remaining;
+
+    /**
+     * Counts the batches, a thread knows a new one by it.
+     */
+    std::size_t generation;
+
+    /**
+     * The first exception thrown by a task of the batch.
+     */
+    std::exception_ptr error;
+
+    bool stopping;
+};
+
+/**
+ * One modular exponentiation x^y mod m of a batch.
+ */
+struct PowerModJob {
+    BigInteger x;
+    BigInteger y;
+    BigInteger m;
+};
+
+/**
+ * Computes x^y mod m of all the jobs by powerMod on the threads of the pool, the i-th result belongs to the i-th job.
+ * Every thread computes with its own memory pool and its own random generator, the shared caches are locked.
+ */
+std::vector<BigInteger> powerModBatch(const PowerModJob * jobs, std::size_t count, WorkStealingPool & pool) {
+    std::vector<BigInteger> results(count);
+    pool.run(count, [&](std::size_t i) {
+        BigInteger power(jobs[i].x);
+        power.powerMod(jobs[i].y, jobs[i].m);
+        results[i].swap(power);
+    });
+    return results;
+}
+
+/**
+ * The batch on a pool of the given number of threads (0 for one per hardware thread) just for these jobs.
+ */
+std::vector<BigInteger> powerModBatch(const std::vector<PowerModJob> & jobs, unsigned threads = 0) {
+    WorkStealingPool pool(threads);
+    return powerModBatch(jobs.data(), jobs.size(), pool);
 }
 
 std::vector<std::size_t> BigInteger::toRadix(std::size_t radix) const {
-    std::vector<std::size_t> res;
     BigInteger d = *this;
-    if (!d.positive) {
-        d.negate();
-    }
-    d.normalize();
+    d.abs();
 
     if (d.length == 0) {
-        res.push_back(0);
-    } else {
-        std::stack<size_t> digits;
-        DivisionResult divRes;
-        while (d.compare(0) > 0) {
-            divideAndMod(d, radix, divRes);
-            d = divRes.quotient;
-            digits.push((size_t) divRes.remainder.intValue());
-        }
-
-        while (digits.size()) {
-            res.push_back(digits.top());
-            digits.pop();
-        }
+        return std::vector<std::size_t>(1, 0);
     }
 
+    // Padded to the upper bound of the length, the leading zeros are cut afterwards.
+    std::size_t width = digitBound(d, radix);
+    std::vector<std::size_t> res(width);
+    writeDigits(d, radix, res.data() + width, width);
+
+    std::size_t first = 0;
+    while (res[first] == 0) {
+        ++first;
+    }
+    res.erase(res.begin(), res.begin() + first);
     return res;
 }
 
 // Technical C++ stuff.
+//
+// The operators taking a BigInteger && compute the result in the limbs of the expiring operand instead of a copy.
 
-BigInteger operator-(BigInteger & a) {
+BigInteger operator-(const BigInteger & a) {
     BigInteger aC(a);
     aC.negate();
     return aC;
 }
 
+BigInteger operator-(BigInteger && a) {
+    a.negate();
+    return std::move(a);
+}
+
 BigInteger & operator+=(BigInteger & a, const BigInteger & b) {
     a.add(b);
     return a;
@@ -862,6 +3478,21 @@ BigInteger operator+(const BigInteger & a, const BigInteger & b) {
     return aCpy;
 }
 
+BigInteger operator+(BigInteger && a, const BigInteger & b) {
+    a += b;
+    return std::move(a);
+}
+
+BigInteger operator+(const BigInteger & a, BigInteger && b) {
+    b += a;
+    return std::move(b);
+}
+
+BigInteger operator+(BigInteger && a, BigInteger && b) {
+    a += b;
+    return std::move(a);
+}
+
 BigInteger & operator-=(BigInteger & a, const BigInteger & b) {
     a.subtract(b);
     return a;
@@ -873,14 +3504,86 @@ BigInteger operator-(const BigInteger & a, const BigInteger & b) {
     return aCpy;
 }
 
+BigInteger operator-(BigInteger && a, const BigInteger & b) {
+    a -= b;
+    return std::move(a);
+}
+
+BigInteger operator-(const BigInteger & a, BigInteger && b) {
+    // a - b = -(b - a)
+    b -= a;
+    b.negate();
+    return std::move(b);
+}
+
+BigInteger operator-(BigInteger && a, BigInteger && b) {
+    a -= b;
+    return std::move(a);
+}
+
 BigInteger & operator*=(BigInteger & a, const BigInteger & b) {
     a.multiply(b);
     return a;
 }
 
-BigInteger operator*(const BigInteger & a, const BigInteger & b) {
+/**
+ * The product is evaluated once it is known what happens with it, see ProductExpression.
+ */
+ProductExpression operator*(const BigInteger & a, const BigInteger & b) {
+    return ProductExpression(a, b);
+}
+
+ProductModExpression operator%(ProductExpression && p, const BigInteger & m) {
+    return ProductModExpression(p.a, p.b, m);
+}
+
+SumProductExpression operator+(const BigInteger & c, ProductExpression && p) {
+    return SumProductExpression(c, p, false);
+}
+
+SumProductExpression operator+(ProductExpression && p, const BigInteger & c) {
+    return SumProductExpression(c, p, false);
+}
+
+SumProductExpression operator-(const BigInteger & c, ProductExpression && p) {
+    return SumProductExpression(c, p, true);
+}
+
+BigInteger operator+(BigInteger && c, ProductExpression && p) {
+    c.addMul(p.a, p.b);
+    return std::move(c);
+}
+
+BigInteger operator+(ProductExpression && p, BigInteger && c) {
+    c.addMul(p.a, p.b);
+    return std::move(c);
+}
+
+BigInteger operator-(BigInteger && c, ProductExpression && p) {
+    c.subMul(p.a, p.b);
+    return std::move(c);
+}
+
+BigInteger operator+(ProductExpression && p, ProductExpression && q) {
+    BigInteger sum(std::move(p));
+    sum.addMul(q.a, q.b);
+    return sum;
+}
+
+BigInteger & operator+=(BigInteger & c, ProductExpression && p) {
+    return c.addMul(p.a, p.b);
+}
+
+BigInteger & operator-=(BigInteger & c, ProductExpression && p) {
+    return c.subMul(p.a, p.b);
+}
+
+/**
+ * The square a * a.
+ */
+BigInteger sqr(const BigInteger & a) {
     BigInteger aCpy = a;
-    aCpy *= b;
+    aCpy.square();
     return aCpy;
 }
 
@@ -895,6 +3598,11 @@ BigInteger operator/(const BigInteger & a, const BigInteger & b) {
     return aCpy;
 }
 
+BigInteger operator/(BigInteger && a, const BigInteger & b) {
+    a /= b;
+    return std::move(a);
+}
+
 BigInteger & operator%=(BigInteger & a, const BigInteger & b) {
     a.mod(b);
     return a;
@@ -906,6 +3614,11 @@ BigInteger operator%(const BigInteger & a, const BigInteger & b) {
     return aCpy;
 }
 
+BigInteger operator%(BigInteger && a, const BigInteger & b) {
+    a %= b;
+    return std::move(a);
+}
+
 BigInteger& operator++(BigInteger& a) { // prefix
     a.add(1);
     return a;
@@ -952,19 +3665,31 @@ bool operator<=(const BigInteger & a, const BigInteger & b) {
 
 std::string BigInteger::toString(char radix) const {
     char digitMap [] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
-    std::stringstream ss;
 
     BigInteger d = *this;
-    if (!d.positive) {
-        ss << "-";
+    d.abs();
+    if (d.isZero()) {
+        return "0";
     }
 
-    std::vector<std::size_t> digits = toRadix(radix);
-    for (std::size_t i = 0; i < digits.size(); ++i) {
-        ss << digitMap[digits[i]];
+    // The digit values go directly into the string, one place is left for the sign.
+    std::size_t width = digitBound(d, radix);
+    std::string str(width + 1, 0);
+    writeDigits(d, radix, &str[0] + width + 1, width);
+
+    std::size_t first = 1;
+    while (str[first] == 0) {
+        ++first;
     }
+    for (std::size_t i = first; i < str.size(); ++i) {
+        str[i] = digitMap[(std::size_t) str[i]];
+    }
+    if (!positive) {
+        str[--first] = '-';
+    }
+    str.erase(0, first);
 
-    return ss.str();
+    return str;
 }
 
 std::size_t getRadix(std::ios_base & stream) {
@@ -985,9 +3710,10 @@ std::ostream & operator<<(std::ostream & out, const BigInteger & a) {
 
 std::istream & operator>>(std::istream & in, BigInteger & b) {
     std::string str;
-    in >> str;
-    BigInteger a(str, getRadix(in));
-    b.swap(a);
+    if (in >> str) {
+        BigInteger a(str, getRadix(in));
+        b.swap(a);
+    }
     return in;
 }
 
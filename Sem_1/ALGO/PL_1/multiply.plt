@@ -0,0 +1,20 @@
+# Multiplication plot
+#====================
+
+# Uncomment the following two lines to generate a png file as output
+#set terminal png 
+#set output 'multiply.png'
+
+# .. or these for eps files
+set terminal postscript eps enhanced color font 'Helvetica,10'
+set output 'multiply.eps'
+
+set title 'Multiplication algorithms'
+set ylabel 'Time [us]'
+set xlabel 'Bit length of numbers'
+
+# Plot data from the created file "multiply.data", one line for each algorithm
+plot 'multiply.data' using 1:2 title 'Schoolbook' with linespoints, 'multiply.data' using 1:3 title 'Karatsuba' with linespoints, 'multiply.data' using 1:4 title 'Toom-3 from this size on' with linespoints
+
+# Keep the result window open
+pause -1
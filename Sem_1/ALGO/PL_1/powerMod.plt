@@ -13,8 +13,17 @@ set title 'Fast modular exponentiation'
 set ylabel 'Time [ms]'
 set xlabel 'Bit length of numbers'
 
-# Plot data from the created file "powerMod.data" and also the polynomials 0.0005*n^3 and 0.000250*n^3
-plot 'powerMod.data' using 1:2 title 'Fast modular exponentiation' with linespoints, 0.0005*x**3 title '0.0005*n^3', 0.000250*x**3 title '0.000250*n^3'
+# Plot data from the created files "powerMod.data" and "powerModConstTime.data" (powerMod and powerModConstTime with
+# an odd modulus) and also the polynomials 0.0005*n^3 and 0.000250*n^3
+plot 'powerMod.data' using 1:2 title 'Fast modular exponentiation' with linespoints, \
+     'powerModConstTime.data' using 1:2 title 'powerMod (odd m)' with linespoints, \
+     'powerModConstTime.data' using 1:3 title 'powerModConstTime (odd m)' with linespoints, \
+     0.0005*x**3 title '0.0005*n^3', 0.000250*x**3 title '0.000250*n^3'
+
+# The throughput of powerModBatch against the number of threads ("powerModBatch.data") instead:
+#set xlabel 'Threads'
+#set ylabel 'powerMod per second'
+#plot 'powerModBatch.data' using 1:2 title 'powerModBatch' with linespoints
 
 # Keep the result window open
 pause -1
@@ -8,6 +8,8 @@
 
 #include <iomanip> // setw()
 #include <climits> // ..._MAX
+#include <string>
+#include <vector>
 
 #include "../BigInteger.h"
 
@@ -71,7 +73,7 @@ public:
      * @param i
      * @return
      */
-    BigInteger get(int i) {
+    const BigInteger & get(int i) const {
         return numbers[i];
     }
 
@@ -90,6 +92,25 @@ public:
 // ALGORITHMS
 // ==========================================================================
 
+/**
+ * Fast modular exponentiation, recursive, with the Montgomery multiplication.
+ * @param x in the Montgomery form
+ * @param y
+ * @param context Montgomery context of the modulus
+ * @return x^y in the Montgomery form
+ */
+BigInteger powerModRecursive(const BigInteger& x, BigInteger y, const MontgomeryContext& context) {
+    if (y == 0) {
+        return context.one();
+    }
+    BigInteger z = powerModRecursive(context.sqrMont(x), y / 2, context);
+    if (y.isEven()) {
+        return z;
+    } else {
+        return context.mulMont(z, x);
+    }
+}
+
 /**
  * Fast modular exponentiation, recursive.
  * @param x
@@ -98,20 +119,20 @@ public:
  * @return x^y mod m
  */
 BigInteger powerModRecursive(BigInteger x, BigInteger y, const BigInteger& m) {
-    // TODO
+    // Odd modulus - Montgomery multiplication instead of the divisions.
+    if (m > 0 && m.isOdd()) {
+        MontgomeryContext context(m);
+        return context.fromMont(powerModRecursive(context.toMont(x), y, context));
+    }
     if (y == 0)
         return 1;
-    if (y == 1)
-        return  x % m;
-    // This naive implementation is just a placeholder so that the test program works properly.
-    // It should be replaced by a more efficient implementation.
-    BigInteger z = BigInteger(1);
-    z = (x % m * x % m) % m;
+    // x^y = (x^(y/2))^2, times x if y is odd
+    BigInteger z = powerModRecursive(x, y / 2, m);
+    z = sqr(z) % m;
     if (!y.isEven())
-        z = z * x;
-    y  = y / 2;
+        z = z * x % m;
 
-    return powerModRecursive(z, y, m);
+    return z;
 }
 
 
@@ -254,6 +275,13 @@ void testBigInteger(void) {
         cout << bigNum << " - " << smallNum << " >= 0" << endl;
     }
 
+    // a product is an expression, but reads like a number (a stored "auto p = a * b;" cannot be used - it would dangle)
+    cout << smallNum << " * " << bigNum << " = " << (smallNum * bigNum).toString()
+         << ", zero: " << (smallNum * bigNum).isZero()
+         << ", bits: " << (smallNum * bigNum).getLength()
+         << ", max with 1000: " << std::max<BigInteger>(smallNum * bigNum, 1000)
+         << ", max with 100: " << std::max(BigInteger(smallNum * bigNum), BigInteger(100)) << endl;
+
     // swapping numbers
     cout << "a = " << smallNum << endl;
     cout << "b = " << bigNum << endl;
@@ -332,9 +360,28 @@ void testTimer(void) {
     cout << (wallTimeDuration.count() * 1000) << " ms" << endl;
 }
 
+/**
+ * Average CPU time of one x.powerMod(y, m) (or x.powerModConstTime(y, m)) in milliseconds.
+ */
+double timePowerMod(const BigInteger& x, const BigInteger& y, const BigInteger& m, bool constTime) {
+    Timer t;
+    long repetitions = 0;
+    t.start();
+    do {
+        BigInteger z = x;
+        if (constTime) {
+            z.powerModConstTime(y, m);
+        } else {
+            z.powerMod(y, m);
+        }
+        ++repetitions;
+    } while (t.stop() < 100);
+    return (double) t.getTime() / repetitions;
+}
+
 /**
  * Time measuring for 'powerModRecursive'.
- * Writes results to "powerMod.data".
+ * Writes results to "powerMod.data", the comparison of powerMod and powerModConstTime to "powerModConstTime.data".
  */
 void finalTest() {
     ofstream file;
@@ -364,9 +411,145 @@ void finalTest() {
     }
 
     file.close();
+
+    // The same numbers with an odd modulus, powerMod against the constant-time powerModConstTime.
+    file.open("powerModConstTime.data");
+
+    cout << "bit length of x, y and m --- powerMod --- powerModConstTime (in ms)" << endl;
+
+    for (int i = 0; i < TestData::N; i++) {
+        BigInteger modulus = m.get(i);
+        if (modulus.isEven()) {
+            modulus += 1;
+        }
+
+        double variableTime = timePowerMod(x.get(i), y.get(i), modulus, false);
+        double constantTime = timePowerMod(x.get(i), y.get(i), modulus, true);
+
+        file << x.bits(i) << " " << variableTime << " " << constantTime << endl;
+
+        cout << setw(4) << x.bits(i) << " --- " << setw(8) << variableTime << " --- " << constantTime << endl;
+    }
+
+    file.close();
+}
+
+/**
+ * Average CPU time of one multiplication a * b in microseconds.
+ */
+double timeMultiply(const BigInteger& a, const BigInteger& b) {
+    Timer t;
+    long repetitions = 0;
+    t.start();
+    do {
+        BigInteger c = a * b;
+        ++repetitions;
+    } while (t.stop() < 100);
+    return t.getTime() * 1000.0 / repetitions;
+}
+
+/**
+ * Time measuring of the multiplication algorithms around their crossover points.
+ * Writes results to "multiply.data".
+ */
+void testMultiply() {
+    ofstream file;
+    file.open("multiply.data");
+
+    const BigInteger::Thresholds defaults = BigInteger::thresholds();
+    const size_t never = (size_t) -1;
+
+    cout << "Karatsuba from " << defaults.karatsuba * BigInteger::LIMB_BITS << " bits, Toom-3 from "
+         << defaults.toom3 * BigInteger::LIMB_BITS << " bits" << endl;
+    cout << "bit length --- schoolbook --- Karatsuba --- Toom-3 (in microseconds per multiplication)" << endl;
+
+    size_t sizes[] = {1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152, 65536};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        BigInteger a = BigInteger::randomBitL(sizes[i], false, false);
+        BigInteger b = BigInteger::randomBitL(sizes[i], false, false);
+
+        // Only the schoolbook algorithm.
+        BigInteger::thresholds().karatsuba = never;
+        BigInteger::thresholds().toom3 = never;
+        double schoolbook = timeMultiply(a, b);
+
+        // Karatsuba, but no Toom-3.
+        BigInteger::thresholds().karatsuba = defaults.karatsuba;
+        double karatsuba = timeMultiply(a, b);
+
+        // Toom-3 from this size on, so the crossover with Karatsuba shows at every size.
+        BigInteger::thresholds().toom3 = sizes[i] / BigInteger::LIMB_BITS;
+        double toom3 = timeMultiply(a, b);
+        BigInteger::thresholds() = defaults;
+
+        file << sizes[i] << " " << schoolbook << " " << karatsuba << " " << toom3 << endl;
+        cout << setw(10) << sizes[i] << " --- " << setw(10) << schoolbook << " --- " << setw(9) << karatsuba
+             << " --- " << setw(6) << toom3 << endl;
+    }
+
+    BigInteger::thresholds() = defaults;
+    file.close();
+}
+
+/**
+ * Throughput of powerModBatch with 1, 2, 4, ... up to maxThreads threads on the numbers of finalTest, in powerMods per
+ * second of the wall-clock time - the CPU time of clock() adds up the times of all the threads.
+ * Writes results to "powerModBatch.data".
+ */
+void testPowerModBatch(unsigned maxThreads) {
+    ofstream file;
+    file.open("powerModBatch.data");
+
+    TestData x;
+    TestData y;
+    TestData m;
+
+    std::vector<PowerModJob> jobs(TestData::N);
+    std::vector<BigInteger> expected(TestData::N);
+    for (int i = 0; i < TestData::N; i++) {
+        jobs[i].x = x.get(i);
+        jobs[i].y = y.get(i);
+        jobs[i].m = m.get(i);
+
+        // The results to compare with, one after another in this thread.
+        expected[i] = x.get(i);
+        expected[i].powerMod(y.get(i), m.get(i));
+    }
+
+    cout << "hardware threads: " << std::thread::hardware_concurrency() << endl;
+    cout << "threads --- batches of " << TestData::N << " --- powerMod per second" << endl;
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        WorkStealingPool pool(threads);
+
+        // As many batches as fit into a second.
+        long batches = 0;
+        bool correct = true;
+        auto wallTimeStart = std::chrono::system_clock::now();
+        std::chrono::duration<double> wallTimeDuration;
+        do {
+            std::vector<BigInteger> results = powerModBatch(jobs.data(), jobs.size(), pool);
+            correct = correct && results == expected;
+            ++batches;
+            wallTimeDuration = std::chrono::system_clock::now() - wallTimeStart;
+        } while (wallTimeDuration.count() < 1.0);
+
+        double rate = batches * TestData::N / wallTimeDuration.count();
+        file << threads << " " << rate << endl;
+        cout << setw(7) << threads << " --- " << setw(14) << batches << " --- " << rate
+             << (correct ? "" : "  (wrong results!)") << endl;
+    }
+
+    file.close();
 }
 
 int main(int argc, char** argv) {
+    // Benchmark mode "threads [max threads]" - only the throughput of powerModBatch, no steps.
+    if (argc > 1 && std::string(argv[1]) == "threads") {
+        unsigned maxThreads = argc > 2 ? atoi(argv[2]) : 2 * std::max(std::thread::hardware_concurrency(), 1u);
+        testPowerModBatch(maxThreads);
+        return 0;
+    }
+
     // Step 1
     cout << "##### Step 1 ### testBuiltInDatatypes #####" << endl;
     testBuiltInDatatypes();
@@ -403,5 +586,17 @@ int main(int argc, char** argv) {
     cout << "### Step 6 done ###" << endl;
     cin.get();
 
+    // Step 7
+    cout << "##### Step 7 ### testMultiply #####" << endl;
+    testMultiply();
+    cout << "### Step 7 done ###" << endl;
+    cin.get();
+
+    // Step 8
+    cout << "##### Step 8 ### testPowerModBatch #####" << endl;
+    testPowerModBatch(2 * std::max(std::thread::hardware_concurrency(), 1u));
+    cout << "### Step 8 done ###" << endl;
+    cin.get();
+
     return 0;
 }
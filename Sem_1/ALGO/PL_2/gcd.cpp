@@ -2,6 +2,9 @@
 #include <iostream>
 #include <fstream>
 #include <time.h>
+#include <iomanip> // setw()
+#include <cmath> // log2()
+#include <vector>
 
 #include "../BigInteger.h"
 
@@ -65,7 +68,7 @@ public:
      * @param i
      * @return
      */
-    BigInteger get(int i) {
+    const BigInteger & get(int i) const {
         return numbers[i];
     }
 
@@ -84,6 +87,25 @@ public:
 // ALGORITHMS
 // ==========================================================================
 
+/**
+ * Fast modular exponentiation, recursive, with the Montgomery multiplication.
+ * @param x in the Montgomery form
+ * @param y
+ * @param context Montgomery context of the modulus
+ * @return x^y in the Montgomery form
+ */
+BigInteger powerModRecursive(const BigInteger& x, BigInteger y, const MontgomeryContext& context) {
+    if (y == 0) {
+        return context.one();
+    }
+    BigInteger z = powerModRecursive(context.sqrMont(x), y / 2, context);
+    if (y.isEven()) {
+        return z;
+    } else {
+        return context.mulMont(z, x);
+    }
+}
+
 /**
  * Fast modular exponentiation, recursive.
  * @param x
@@ -92,13 +114,18 @@ public:
  * @return x^y mod m
  */
 BigInteger powerModRecursive(BigInteger x, BigInteger y, const BigInteger& m) {
+    // Odd modulus - Montgomery multiplication instead of the divisions.
+    if (m > 0 && m.isOdd()) {
+        MontgomeryContext context(m);
+        return context.fromMont(powerModRecursive(context.toMont(x), y, context));
+    }
     if (y == 0) {
         return 1;
     }
     if (y == 1) {
     	return x % m;
     }
-    BigInteger z = powerModRecursive(x * x % m, y / 2, m);
+    BigInteger z = powerModRecursive(sqr(x) % m, y / 2, m);
     if (y.isEven()) {
         return z;
     } else {
@@ -135,11 +162,24 @@ BigInteger gcdNaive(BigInteger a, BigInteger b) {
 
 }
 
+/**
+ * Bit length from which gcd, extendedEuclid and modularInverse use the half-GCD. It is also the size under which the
+ * half-GCD does Lehmer's steps instead of the recursion.
+ */
+const size_t HALF_GCD_THRESHOLD = 16384;
+
+BigInteger gcdHalf(BigInteger a, BigInteger b);
+
 /**
  * Euclid's algorithm.
  * Computes the GCD of the numbers.
  */
 BigInteger gcd(BigInteger a, BigInteger b) {
+    // The quadratic number of steps is too much for the huge numbers.
+    if (max(a.getLength(), b.getLength()) >= HALF_GCD_THRESHOLD) {
+        return gcdHalf(a, b);
+    }
+
     // It is a more efficient implementation.
     if (b == 0) return a;
     if (a == 0) return b;
@@ -147,6 +187,88 @@ BigInteger gcd(BigInteger a, BigInteger b) {
     return gcd(b, a % b);
 }
 
+/**
+ * Binary (Stein's) algorithm.
+ * Computes the GCD of the numbers without any division - the common power of two is taken out, then the smaller odd
+ * number is subtracted from the larger one and the trailing zeros of the difference are shifted out.
+ */
+BigInteger gcdBinary(BigInteger a, BigInteger b) {
+    a.abs();
+    b.abs();
+    if (b == 0) return a;
+    if (a == 0) return b;
+
+    size_t aZeros = a.lowestBit();
+    size_t bZeros = b.lowestBit();
+    a.shiftRight(aZeros);
+    b.shiftRight(bZeros);
+
+    // Both are odd, so the difference is even and it loses at least one bit.
+    int c;
+    while ((c = a.compare(b)) != 0) {
+        if (c < 0) {
+            a.swap(b);
+        }
+        a.subtract(b);
+        a.shiftRight(a.lowestBit());
+    }
+
+    a.shiftLeft(min(aZeros, bZeros));
+    return a;
+}
+
+/**
+ * One Lehmer step - Euclid's algorithm on the leading 62 bits of a >= b, as long as the quotients are surely the same
+ * as the ones of the full numbers (Knuth's Algorithm L). The 2x2 matrix of the cofactors maps (a, b) to the pair of
+ * remainders that many steps later, (A * a + B * b, C * a + D * b).
+ * Returns false if not even a single step could be simulated, then a full division step has to be done.
+ */
+bool lehmerCofactors(const BigInteger& a, const BigInteger& b, long long& A, long long& B, long long& C, long long& D) {
+    const size_t DIGIT_BITS = 62; // x + A and the other sums must fit into a long long
+    size_t n = a.getLength();
+    if (n <= DIGIT_BITS || a < b) {
+        return false;
+    }
+
+    long long x = a.getBits(n - DIGIT_BITS);
+    long long y = b.getBits(n - DIGIT_BITS);
+    A = 1; B = 0; C = 0; D = 1;
+    while (y + C != 0 && y + D != 0) {
+        long long q = (x + A) / (y + C);
+        if (q != (x + B) / (y + D)) {
+            break;
+        }
+        long long t = A - q * C; A = C; C = t;
+        t = B - q * D; B = D; D = t;
+        t = x - q * y; x = y; y = t;
+    }
+    return B != 0;
+}
+
+/**
+ * Lehmer's algorithm.
+ * Computes the GCD of the numbers - most of Euclid's steps are simulated on the leading bits and applied to the full
+ * numbers only once per machine word of quotients.
+ */
+BigInteger gcdLehmer(BigInteger a, BigInteger b) {
+    a.abs();
+    b.abs();
+    if (a < b) {
+        a.swap(b);
+    }
+
+    long long A, B, C, D;
+    while (b != 0) {
+        if (lehmerCofactors(a, b, A, B, C, D)) {
+            BigInteger::applyMatrix(a, b, A, B, C, D);
+        } else {
+            a %= b;
+            a.swap(b);
+        }
+    }
+    return a;
+}
+
 /**
  * Result of the extended Euclid's algorithm.
  * GCD(a, b) = gcd = ax + by
@@ -157,11 +279,18 @@ struct EuclidResult {
     BigInteger gcd;
 };
 
+void extendedEuclidHalf(const BigInteger& a, const BigInteger& b, EuclidResult& result, bool computeY);
+
 /**
  * Extended Euclid's algorithm
- * Computes the GCD of the numbers and stores it into the result.
+ * Computes the GCD of the numbers and stores it into the result. If computeY is false, only the cofactor x is
+ * computed and y is 0.
+ *
+ * It is iterative, the remainders and the cofactors are kept in the same few numbers for the whole run, so their
+ * arrays are allocated only once (they only grow). Each step swaps them and does one division and one multiplication
+ * and subtraction per cofactor in place.
  */
-void extendedEuclid(const BigInteger& a, const BigInteger& b, EuclidResult& result) {
+void extendedEuclid(const BigInteger& a, const BigInteger& b, EuclidResult& result, bool computeY = true) {
     if (a < 0) {
         throw std::runtime_error("Extended Euclid's Algorithm works only for non-negative values of a.");
     }
@@ -169,17 +298,322 @@ void extendedEuclid(const BigInteger& a, const BigInteger& b, EuclidResult& resu
         throw std::runtime_error("Extended Euclid's Algorithm works only for non-negative values of b.");
     }
 
+    if (max(a.getLength(), b.getLength()) >= HALF_GCD_THRESHOLD) {
+        extendedEuclidHalf(a, b, result, computeY);
+        return;
+    }
+
+    // r0 = x0 * a + y0 * b and r1 = x1 * a + y1 * b all the time.
+    BigInteger r0 = a, r1 = b;
+    BigInteger x0 = 1, x1 = 0, y0 = 0, y1 = 1;
+    DivisionResult d;
+    while (r1 != 0) {
+        // One division gives both r0 / r1 and r0 % r1 into the buffers of d.
+        divideAndMod(r0, r1, d);
+        r0.swap(r1);
+        r1.swap(d.remainder);
+
+        // (x0, x1) becomes (x1, x0 - q * x1) without any new number.
+        x0.swap(x1);
+        x1.subMul(d.quotient, x0);
+        if (computeY) {
+            y0.swap(y1);
+            y1.subMul(d.quotient, y0);
+        }
+    }
+
+    result.gcd.swap(r0);
+    result.x.swap(x0);
+    result.y.swap(y0);
+}
+
+/**
+ * Extended Euclid's algorithm copying the cofactors in every step.
+ * The same as extendedEuclid, kept to compare the allocations.
+ */
+void extendedEuclidCopying(const BigInteger& a, const BigInteger& b, EuclidResult& result) {
     if (b == 0) {
         result.gcd = a;
         result.x = 1;
         result.y = 0;
     } else
     {
-        extendedEuclid(b, a%b, result);
+        extendedEuclidCopying(b, a % b, result);
 
         BigInteger x = result.x;
         result.x = result.y;
-        result.y = x - (a/b)*result.y;
+        result.y = x - (a / b) * result.y;
+    }
+}
+
+/**
+ * Extended Euclid's algorithm by Lehmer's steps.
+ * The cofactors are updated by the same matrices as the remainders, so the result is the same as of extendedEuclid.
+ */
+void extendedEuclidLehmer(const BigInteger& a, const BigInteger& b, EuclidResult& result) {
+    if (a < 0) {
+        throw std::runtime_error("Extended Euclid's Algorithm works only for non-negative values of a.");
+    }
+    if (b < 0) {
+        throw std::runtime_error("Extended Euclid's Algorithm works only for non-negative values of b.");
+    }
+
+    // r0 = x0 * a + y0 * b and r1 = x1 * a + y1 * b all the time.
+    BigInteger r0 = a, r1 = b;
+    BigInteger x0 = 1, x1 = 0, y0 = 0, y1 = 1;
+    long long A, B, C, D;
+    while (r1 != 0) {
+        if (lehmerCofactors(r0, r1, A, B, C, D)) {
+            BigInteger::applyMatrix(r0, r1, A, B, C, D);
+            BigInteger::applyMatrix(x0, x1, A, B, C, D);
+            BigInteger::applyMatrix(y0, y1, A, B, C, D);
+        } else {
+            DivisionResult d = divmod(r0, r1);
+            r0.swap(r1);
+            r1.swap(d.remainder);
+            x0.swap(x1);
+            x1 -= d.quotient * x0;
+            y0.swap(y1);
+            y1 -= d.quotient * y0;
+        }
+    }
+
+    result.gcd = r0;
+    result.x = x0;
+    result.y = y0;
+}
+
+/**
+ * 2x2 matrix of non-negative cofactors with the determinant det = 1 or -1. The half-GCD keeps (a, b) = M (alpha, beta),
+ * that is a = u0 * alpha + u1 * beta and b = v0 * alpha + v1 * beta, for the numbers (a, b) it started with.
+ */
+struct CofactorMatrix {
+    BigInteger u0, u1;
+    BigInteger v0, v1;
+    int det;
+
+    CofactorMatrix() : u0(1), u1(0), v0(0), v1(1), det(1) {
+    }
+
+    bool isIdentity() const {
+        return u1 == 0 && v0 == 0;
+    }
+
+    /**
+     * For the swap of alpha and beta.
+     */
+    void swapColumns() {
+        u0.swap(u1);
+        v0.swap(v1);
+        det = -det;
+    }
+
+    /**
+     * For the step alpha -= q * beta.
+     */
+    void addColumn(const BigInteger& q) {
+        u1.addMul(q, u0);
+        v1.addMul(q, v0);
+    }
+
+    /**
+     * This becomes this * m, eight multiplications of the cofactors.
+     */
+    void multiply(const CofactorMatrix& m) {
+        BigInteger newU0 = u0 * m.u0 + u1 * m.v0;
+        BigInteger newU1 = u0 * m.u1 + u1 * m.v1;
+        BigInteger newV0 = v0 * m.u0 + v1 * m.v0;
+        BigInteger newV1 = v0 * m.u1 + v1 * m.v1;
+        u0.swap(newU0);
+        u1.swap(newU1);
+        v0.swap(newV0);
+        v1.swap(newV1);
+        det *= m.det;
+    }
+
+    /**
+     * (a, b) becomes M^-1 (a, b) = det * (v1 * a - u1 * b, u0 * b - v0 * a).
+     */
+    void applyInverse(BigInteger& a, BigInteger& b) const {
+        BigInteger alpha = v1 * a - u1 * b;
+        BigInteger beta = u0 * b - v0 * a;
+        if (det < 0) {
+            alpha.negate();
+            beta.negate();
+        }
+        a.swap(alpha);
+        b.swap(beta);
+    }
+};
+
+/**
+ * Euclid's steps on alpha and beta as long as both of them stay at least 2^s, the last quotient is cut so that the
+ * remainder does not get below 2^s. Stops when |alpha - beta| < 2^s, then not even one more subtraction is possible,
+ * or as soon as the numbers have at most target bits. Returns false in the first case.
+ * The steps are done by Lehmer's matrices as long as they do not go too far.
+ */
+bool halfGcdSteps(BigInteger& alpha, BigInteger& beta, CofactorMatrix& M, size_t s, size_t target = 0) {
+    long long A, B, C, D;
+    while (true) {
+        if (alpha < beta) {
+            alpha.swap(beta);
+            M.swapColumns();
+        }
+        if ((alpha - beta).getLength() <= s) {
+            return false;
+        }
+        if (alpha.getLength() <= target) {
+            return true;
+        }
+
+        if (lehmerCofactors(alpha, beta, A, B, C, D)) {
+            BigInteger newAlpha = alpha, newBeta = beta;
+            BigInteger::applyMatrix(newAlpha, newBeta, A, B, C, D);
+            if (newBeta.getLength() > s) {
+                // M becomes M * L^-1 for the Lehmer matrix L = [A B; C D], its determinant is 1 or -1, so even the
+                // wrapped products give it exactly.
+                long long e = (long long) ((unsigned long long) A * D - (unsigned long long) B * C);
+                BigInteger::applyMatrix(M.u0, M.u1, e * D, -e * C, -e * B, e * A);
+                BigInteger::applyMatrix(M.v0, M.v1, e * D, -e * C, -e * B, e * A);
+                M.det *= (int) e;
+                alpha.swap(newAlpha);
+                beta.swap(newBeta);
+                continue;
+            }
+        }
+
+        BigInteger q = (alpha - BigInteger::power2(s)) / beta;
+        alpha.subMul(q, beta);
+        M.addColumn(q);
+    }
+}
+
+/**
+ * Half-GCD (Schoenhage's algorithm in the form of Moeller).
+ * For a, b > 0 of at most n bits does Euclid's steps until the numbers are about n / 2 bits: a and b become alpha and
+ * beta >= 2^s, s = n / 2 + 1, with |alpha - beta| < 2^s and M is the matrix of the cofactors, (a, b) = M (alpha, beta).
+ * If min(a, b) < 2^s, nothing is done and M is the identity.
+ *
+ * The steps of the top half of the bits are the steps of the whole numbers, so the first recursive call reduces the
+ * top n - s bits only and its matrix is applied to a and b by fast multiplications. The same is done once more with the
+ * top bits of what is left and the last few steps are done directly. It takes O(M(n) log n) for the multiplication
+ * time M(n).
+ */
+void halfGcd(BigInteger& a, BigInteger& b, CofactorMatrix& M) {
+    M = CofactorMatrix();
+    size_t n = max(a.getLength(), b.getLength());
+    size_t s = n / 2 + 1;
+    if (min(a.getLength(), b.getLength()) <= s) {
+        return;
+    }
+    if (n < HALF_GCD_THRESHOLD) {
+        halfGcdSteps(a, b, M, s);
+        return;
+    }
+
+    // If the top numbers end up above 2^s0, their matrix keeps a and b above 2^(s + s0 - 1) >= 2^s.
+    BigInteger a0 = a, b0 = b;
+    a0.shiftRight(s);
+    b0.shiftRight(s);
+    halfGcd(a0, b0, M);
+    if (!M.isIdentity()) {
+        M.applyInverse(a, b);
+    }
+
+    // About 3n / 4 bits should be left, a few steps more are needed if the top numbers could not be reduced.
+    if (!halfGcdSteps(a, b, M, s, (n + s) / 2 + 1)) {
+        return;
+    }
+
+    // The top 2 (n2 - s) bits of the n2 left are reduced to n2 - s + 1, which keeps a and b above 2^s again.
+    size_t n2 = max(a.getLength(), b.getLength());
+    size_t p = 2 * s - n2;
+    BigInteger a1 = a, b1 = b;
+    a1.shiftRight(p);
+    b1.shiftRight(p);
+    CofactorMatrix M2;
+    halfGcd(a1, b1, M2);
+    if (!M2.isIdentity()) {
+        M2.applyInverse(a, b);
+        M.multiply(M2);
+    }
+
+    halfGcdSteps(a, b, M, s);
+}
+
+/**
+ * Subquadratic gcd.
+ * Computes the GCD of the numbers by the half-GCD, each call halves the numbers and one division step follows it.
+ * The numbers under HALF_GCD_THRESHOLD bits are left to Lehmer's algorithm.
+ */
+BigInteger gcdHalf(BigInteger a, BigInteger b) {
+    a.abs();
+    b.abs();
+
+    // A zero is never swapped into the divisor, Lehmer's algorithm does the rest.
+    CofactorMatrix M;
+    while (a != 0 && b != 0 && max(a.getLength(), b.getLength()) >= HALF_GCD_THRESHOLD) {
+        halfGcd(a, b, M);
+        if (a < b) {
+            a.swap(b);
+        }
+        a %= b;
+        a.swap(b);
+    }
+    return gcdLehmer(a, b);
+}
+
+/**
+ * Subquadratic extended Euclid's algorithm.
+ * The numbers are reduced by the half-GCD and the division steps as in gcdHalf, their product T with (a, b) =
+ * T (r0, r1) gives the cofactors of the result of extendedEuclidLehmer on the small numbers r0, r1 in the end. The
+ * cofactors are reduced to |x| <= b / (2 gcd), so they are as small as the ones of extendedEuclid. y comes from x by
+ * one division, which is left out if computeY is false.
+ */
+void extendedEuclidHalf(const BigInteger& a, const BigInteger& b, EuclidResult& result, bool computeY) {
+    BigInteger r0 = a, r1 = b;
+    CofactorMatrix T, M;
+    while (r0 != 0 && r1 != 0 && max(r0.getLength(), r1.getLength()) >= HALF_GCD_THRESHOLD) {
+        halfGcd(r0, r1, M);
+        T.multiply(M);
+        if (r0 < r1) {
+            r0.swap(r1);
+            T.swapColumns();
+        }
+
+        // (r0, r1) becomes (r1, r0 - q * r1), T becomes T * [q 1; 1 0].
+        DivisionResult d = divmod(r0, r1);
+        r0.swap(r1);
+        r1.swap(d.remainder);
+        T.addColumn(d.quotient);
+        T.swapColumns();
+    }
+
+    // gcd = x' r0 + y' r1 and (r0, r1) = T^-1 (a, b) = det * (v1 a - u1 b, u0 b - v0 a).
+    EuclidResult rest;
+    extendedEuclidLehmer(r0, r1, rest);
+    result.gcd = rest.gcd;
+    result.x = rest.x * T.v1 - rest.y * T.v0;
+    if (T.det < 0) {
+        result.x.negate();
+    }
+
+    // Any x + k b / gcd with y - k a / gcd works as well.
+    if (b != 0 && result.gcd != 0) {
+        BigInteger n = b / result.gcd;
+        result.x %= n;
+        if (result.x + result.x > n) {
+            result.x -= n;
+        }
+    }
+
+    if (!computeY) {
+        result.y = 0;
+    } else if (b != 0) {
+        result.y = (result.gcd - a * result.x) / b;
+    } else {
+        // (a, 0) never gets to the half-GCD steps, T is the identity.
+        result.y = rest.y;
     }
 }
 
@@ -195,9 +629,12 @@ EuclidResult extendedEuclid(const BigInteger& a, const BigInteger& b) {
 
 /**
  * Computes the multiplicative inverse of x modulo m.
+ * Only the cofactor x of the extended Euclid's algorithm is needed, the other one is not computed at all. From
+ * HALF_GCD_THRESHOLD bits on, extendedEuclid gives it by the half-GCD.
  */
 BigInteger modularInverse(const BigInteger& x, const BigInteger& m) {
-    EuclidResult r = extendedEuclid(x, m);
+    EuclidResult r;
+    extendedEuclid(x, m, r, false);
     if(r.gcd == 1) {
         return r.x % m; // In case of negative r.x.
     } else {
@@ -205,15 +642,106 @@ BigInteger modularInverse(const BigInteger& x, const BigInteger& m) {
     }
 }
 
+/**
+ * Result of the batch modular inversion.
+ * inverses[i] is the inverse of the i-th number, or 0 if i is in notInvertible (the indices in ascending order).
+ */
+struct BatchInverseResult {
+    std::vector<BigInteger> inverses;
+    std::vector<size_t> notInvertible;
+};
+
+/**
+ * Montgomery's trick: the products r[0] * ... * r[i] modulo m are stored, only the last one is inverted and the inverses
+ * of the numbers are peeled off it from the end. Returns the gcd of the whole product and m, the inverses are stored
+ * only if it is 1.
+ */
+BigInteger montgomeryInverse(const std::vector<BigInteger>& r, const BigInteger& m, std::vector<BigInteger>& inverses) {
+    size_t n = r.size();
+    std::vector<BigInteger> prefix(n);
+    prefix[0] = r[0];
+    for (size_t i = 1; i < n; i++) {
+        prefix[i].mulMod(prefix[i - 1], r[i], m);
+    }
+
+    EuclidResult e;
+    extendedEuclid(prefix[n - 1], m, e, false);
+    if (e.gcd != 1) {
+        return e.gcd;
+    }
+
+    // inverse = (r[0] * ... * r[i])^-1, the inverse of r[i] is inverse * r[0] * ... * r[i - 1].
+    BigInteger inverse = e.x % m;
+    for (size_t i = n - 1; i > 0; i--) {
+        inverses[i].mulMod(inverse, prefix[i - 1], m);
+        inverse.mulMod(inverse, r[i], m);
+    }
+    inverses[0].swap(inverse);
+    return e.gcd;
+}
+
+/**
+ * Computes the multiplicative inverses of all the numbers modulo m > 0.
+ * It takes a single extendedEuclid and 3(n - 1) modular multiplications if all of them have an inverse. The numbers
+ * without an inverse do not throw as in modularInverse, their indices are reported in the result.
+ */
+BatchInverseResult batchModularInverse(const std::vector<BigInteger>& xs, const BigInteger& m) {
+    if (m <= 0) {
+        throw std::runtime_error("Modular inverses need a positive modulus, not " + m.toString() + "!");
+    }
+
+    BatchInverseResult result;
+    result.inverses.resize(xs.size());
+    if (xs.empty()) {
+        return result;
+    }
+
+    // The multiples of m have no inverse (unless m = 1, then 0 is its own inverse). They are replaced by 1, so the
+    // product never gets 0.
+    std::vector<bool> invertible(xs.size(), true);
+    std::vector<BigInteger> r(xs.size());
+    for (size_t i = 0; i < xs.size(); i++) {
+        r[i] = xs[i] % m;
+        if (r[i] == 0 && m != 1) {
+            invertible[i] = false;
+            r[i] = 1;
+        }
+    }
+
+    BigInteger g = montgomeryInverse(r, m, result.inverses);
+    if (g != 1) {
+        // A prime factor of m divides r[i] exactly if it divides g, the gcd of the product and m. So the numbers
+        // without an inverse are found by the gcd with g, which is cheap as long as g is small. They are replaced by
+        // 1 and the rest is inverted once more.
+        for (size_t i = 0; i < r.size(); i++) {
+            if (invertible[i] && gcd(g, r[i] % g) != 1) {
+                invertible[i] = false;
+                r[i] = 1;
+            }
+        }
+        montgomeryInverse(r, m, result.inverses);
+    }
+
+    for (size_t i = 0; i < xs.size(); i++) {
+        if (!invertible[i]) {
+            result.notInvertible.push_back(i);
+            result.inverses[i] = 0;
+        }
+    }
+    return result;
+}
+
 
 // ==========================================================================
 // Tests / Time measuring
 // ==========================================================================
 
 void testGcd() {
-    ofstream fileNaive, fileEuclid;
+    ofstream fileNaive, fileEuclid, fileBinary, fileLehmer;
     fileNaive.open("gcdNaive.data");
     fileEuclid.open("gcdEuclid.data");
+    fileBinary.open("gcdBinary.data");
+    fileLehmer.open("gcdLehmer.data");
 
     TestData a;
     TestData b;
@@ -246,11 +774,96 @@ void testGcd() {
         cout << a.bits(i) << "bit  t=" << t.getTime() << "ms  gcd(" << a.get(i) << ", " << b.get(i) << ") = " << d << endl;
     }
     fileEuclid.close();
+
+    // test gcdBinary on the same numbers as gcdEuclid
+    cout << "gcdBinary:" << endl;
+    for (int i = 15; i < min((int)TestData::N, /*2256*/1600); i+=16) {
+        t.start();
+        BigInteger d = gcdBinary(a.get(i), b.get(i));
+        t.stop();
+        fileBinary << a.bits(i) << " " << t.getTime() << endl;
+        cout << a.bits(i) << "bit  t=" << t.getTime() << "ms  gcdBinary(" << a.get(i) << ", " << b.get(i) << ") = " << d << endl;
+    }
+    fileBinary.close();
+
+    // test gcdLehmer on all the sizes of the test data
+    cout << "gcdLehmer:" << endl;
+    for (int i = 15; i < TestData::N; i+=16) {
+        t.start();
+        BigInteger d = gcdLehmer(a.get(i), b.get(i));
+        t.stop();
+        fileLehmer << a.bits(i) << " " << t.getTime() << endl;
+        cout << a.bits(i) << "bit  t=" << t.getTime() << "ms  gcdLehmer(" << a.get(i) << ", " << b.get(i) << ") = " << d << endl;
+    }
+    fileLehmer.close();
+}
+
+/**
+ * Counts the limb arrays the BigIntegers ask for during Euclid's algorithm.
+ * Every inline buffer is a heap allocation saved by the small-buffer storage of BigInteger.
+ */
+void testGcdAllocations() {
+    TestData a;
+    TestData b;
+
+    BigInteger::AllocationCounter & counter = BigInteger::allocationCounter();
+    size_t totalInline = 0, totalHeap = 0;
+
+    cout << "bit length --- inline buffers --- heap allocations" << endl;
+    for (int i = 15; i < min((int)TestData::N, /*2256*/1600); i+=16) {
+        BigInteger x = a.get(i), y = b.get(i);
+        counter.inlineBuffers = 0;
+        counter.heapBuffers = 0;
+        gcd(x, y);
+        totalInline += counter.inlineBuffers;
+        totalHeap += counter.heapBuffers;
+        cout << setw(10) << a.bits(i) << " --- " << setw(14) << counter.inlineBuffers
+             << " --- " << setw(16) << counter.heapBuffers << endl;
+    }
+    cout << "in total " << totalHeap << " heap allocations instead of " << (totalInline + totalHeap)
+         << " without the inline storage" << endl;
+}
+
+/**
+ * Counts the heap allocations of one extendedEuclid call - the iterative one with its fixed buffers, the same with
+ * the cofactor x only (as for modularInverse) and the recursive one copying the cofactors in every step as before.
+ */
+void testExtendedEuclidAllocations() {
+    TestData a;
+    TestData b;
+
+    BigInteger::AllocationCounter & counter = BigInteger::allocationCounter();
+    size_t totalIterative = 0, totalSingle = 0, totalCopying = 0;
+
+    cout << "bit length --- extendedEuclid --- x only --- copying extendedEuclid" << endl;
+    for (int i = 15; i < min((int)TestData::N, /*2256*/1600); i+=16) {
+        EuclidResult res;
+        counter.heapBuffers = 0;
+        extendedEuclid(a.get(i), b.get(i), res);
+        size_t iterative = counter.heapBuffers;
+
+        counter.heapBuffers = 0;
+        extendedEuclid(a.get(i), b.get(i), res, false);
+        size_t single = counter.heapBuffers;
+
+        counter.heapBuffers = 0;
+        extendedEuclidCopying(a.get(i), b.get(i), res);
+        size_t copying = counter.heapBuffers;
+
+        totalIterative += iterative;
+        totalSingle += single;
+        totalCopying += copying;
+        cout << setw(10) << a.bits(i) << " --- " << setw(14) << iterative << " --- " << setw(6) << single
+             << " --- " << setw(22) << copying << endl;
+    }
+    cout << "in total " << totalIterative << " (x only " << totalSingle << ") heap allocations instead of "
+         << totalCopying << endl;
 }
 
 void testExtendedEuclid() {
-    ofstream fileExtended;
+    ofstream fileExtended, fileExtendedLehmer;
     fileExtended.open("gcdExtended.data");
+    fileExtendedLehmer.open("gcdExtendedLehmer.data");
 
     TestData a;
     TestData b;
@@ -259,14 +872,144 @@ void testExtendedEuclid() {
 
     cout << "extendedEuclid:" << endl;
     for (int i = 15; i < min((int)TestData::N, /*2256*/1600); i+=16) {
+        EuclidResult res;
         t.start();
-        EuclidResult res = extendedEuclid(a.get(i), b.get(i));
+        {
+            // The temporaries of one call are cut from an arena and freed at once, only res is outside of it.
+            BigInteger::Arena arena;
+            extendedEuclid(a.get(i), b.get(i), res);
+        }
         t.stop();
         fileExtended << a.bits(i) << " " << t.getTime() << endl;
         cout << a.bits(i) << "bit  t=" << t.getTime() << "ms  extendedEuclid("
              << a.get(i) << ", " << b.get(i) << ").gcd = " << res.gcd << endl;
     }
     fileExtended.close();
+
+    cout << "extendedEuclidLehmer:" << endl;
+    for (int i = 15; i < TestData::N; i+=16) {
+        EuclidResult res;
+        t.start();
+        {
+            BigInteger::Arena arena;
+            extendedEuclidLehmer(a.get(i), b.get(i), res);
+        }
+        t.stop();
+        fileExtendedLehmer << a.bits(i) << " " << t.getTime() << endl;
+        cout << a.bits(i) << "bit  t=" << t.getTime() << "ms  extendedEuclidLehmer("
+             << a.get(i) << ", " << b.get(i) << ").gcd = " << res.gcd << endl;
+    }
+    fileExtendedLehmer.close();
+
+    /*
+     * The numbers from HALF_GCD_THRESHOLD bits on go to the half-GCD. Its time divided by M(n) log n, M(n) the time of
+     * one multiplication of the numbers, should stay about the same when the size doubles.
+     */
+    ofstream fileExtendedHalf;
+    fileExtendedHalf.open("gcdExtendedHalf.data");
+    cout << "extendedEuclid by the half-GCD:" << endl;
+    for (size_t bits = HALF_GCD_THRESHOLD; bits <= (1 << 20); bits *= 2) {
+        BigInteger x = BigInteger::randomBitL(bits, false, false);
+        BigInteger y = BigInteger::randomBitL(bits, false, false);
+        EuclidResult res;
+        t.start();
+        extendedEuclid(x, y, res);
+        long time = t.stop();
+
+        // One multiplication is too fast for the timer, so as many of them as fit into 100ms.
+        int count = 0;
+        t.start();
+        do {
+            BigInteger product = x * y;
+            count++;
+        } while (t.stop() < 100);
+        double multiplication = (double) t.getTime() / count;
+
+        fileExtendedHalf << bits << " " << time << " " << multiplication << endl;
+        cout << bits << "bit  t=" << time << "ms  M(n)=" << multiplication << "ms  t / (M(n) log n) = "
+             << time / (multiplication * log2((double) bits)) << "  gcd = " << res.gcd << endl;
+
+        // With a zero there is nothing to reduce, the gcd is the other number.
+        EuclidResult zero;
+        extendedEuclid(0, y, zero);
+        if (gcd(BigInteger(0), y) != y || zero.gcd != y || zero.x != 0 || zero.y != 1) {
+            cout << "wrong gcd(0, y) for " << bits << " bits" << endl;
+        }
+        extendedEuclid(x, 0, zero);
+        if (gcd(x, BigInteger(0)) != x || zero.gcd != x || zero.x != 1 || zero.y != 0) {
+            cout << "wrong gcd(x, 0) for " << bits << " bits" << endl;
+        }
+    }
+    fileExtendedHalf.close();
+}
+
+/**
+ * Inversions per second of modularInverse called for each number and of batchModularInverse, for all the numbers of
+ * TestData modulo a random odd number of 256 to 4096 bits.
+ */
+void testBatchModularInverse() {
+    ofstream file;
+    file.open("batchModularInverse.data");
+
+    TestData a;
+    std::vector<BigInteger> xs(TestData::N);
+    for (int i = 0; i < TestData::N; i++) {
+        xs[i] = a.get(i);
+    }
+
+    Timer t;
+
+    cout << "modulus bits --- modularInverse/s --- batchModularInverse/s --- not invertible" << endl;
+    for (size_t bits = 256; bits <= 4096; bits *= 2) {
+        BigInteger m = BigInteger::randomBitL(bits, false, false);
+        if (m.isEven()) {
+            m += 1;
+        }
+
+        size_t failures = 0;
+        t.start();
+        for (int i = 0; i < TestData::N; i++) {
+            try {
+                modularInverse(xs[i], m);
+            } catch(std::runtime_error& e) {
+                failures++;
+            }
+        }
+        long single = t.stop();
+
+        t.start();
+        BatchInverseResult res = batchModularInverse(xs, m);
+        long batch = t.stop();
+
+        if (failures != res.notInvertible.size()) {
+            cout << "The numbers without an inverse differ: " << failures << " and " << res.notInvertible.size() << endl;
+        }
+
+        // At least 1ms, so that the rate is finite.
+        double singleRate = TestData::N * 1000.0 / max(single, 1L);
+        double batchRate = TestData::N * 1000.0 / max(batch, 1L);
+        file << bits << " " << singleRate << " " << batchRate << endl;
+        cout << setw(12) << bits << " --- " << setw(16) << (long) singleRate << " --- " << setw(21) << (long) batchRate
+             << " --- " << setw(14) << res.notInvertible.size() << endl;
+    }
+    file.close();
+
+    // A modulus for the half-GCD with 0 and m among the numbers, only these two have no inverse.
+    BigInteger m = BigInteger::power2(HALF_GCD_THRESHOLD + 1000) + 1;
+    std::vector<BigInteger> zeros;
+    zeros.push_back(3);
+    zeros.push_back(0);
+    zeros.push_back(m);
+    zeros.push_back(5);
+    BatchInverseResult res = batchModularInverse(zeros, m);
+    bool correct = res.notInvertible.size() == 2 && res.notInvertible[0] == 1 && res.notInvertible[1] == 2;
+    for (size_t i = 0; i < zeros.size(); i++) {
+        if (res.inverses[i] != 0 && res.inverses[i] * zeros[i] % m != 1) {
+            correct = false;
+        }
+    }
+    cout << "0 and m among the numbers modulo 2^" << HALF_GCD_THRESHOLD + 1000 << " + 1: "
+         << (correct ? "no inverse at the indices 1 and 2" : "wrong result!") << endl;
 }
 
 int main(int argc, char** argv) {
@@ -284,6 +1027,12 @@ int main(int argc, char** argv) {
     cout << "gcd(12,9) = " << gcd(12,9) << endl;
     cout << "gcd(17,13) = " << gcd(17,13) << endl;
     cout << "gcd(0,0) = " << gcd(0,0) << endl;
+    cout << "gcdBinary(12,9) = " << gcdBinary(12,9) << endl;
+    cout << "gcdBinary(17,13) = " << gcdBinary(17,13) << endl;
+    cout << "gcdBinary(0,0) = " << gcdBinary(0,0) << endl;
+    cout << "gcdLehmer(12,9) = " << gcdLehmer(12,9) << endl;
+    cout << "gcdLehmer(17,13) = " << gcdLehmer(17,13) << endl;
+    cout << "gcdLehmer(0,0) = " << gcdLehmer(0,0) << endl;
     cout << "### Step 2 done ###" << endl;
     cin.get();
 
@@ -333,5 +1082,44 @@ int main(int argc, char** argv) {
     cout << "### Step 6 done ###" << endl;
     cin.get();
 
+    // Step 7
+    cout << "##### Step 7 ### testGcdAllocations #####" << endl;
+    testGcdAllocations();
+    cout << "### Step 7 done ###" << endl;
+    cin.get();
+
+    // Step 8
+    cout << "##### Step 8 ### testExtendedEuclidAllocations #####" << endl;
+    testExtendedEuclidAllocations();
+    cout << "### Step 8 done ###" << endl;
+    cin.get();
+
+    // Step 9
+    cout << "##### Step 9 ### test batchModularInverse #####" << endl;
+    std::vector<BigInteger> xs;
+    xs.push_back(5);
+    xs.push_back(12);
+    xs.push_back(7);
+    xs.push_back(0);
+    xs.push_back(9);
+    xs.push_back(11);
+    BatchInverseResult inverses = batchModularInverse(xs, 12);
+    for (size_t i = 0; i < xs.size(); i++) {
+        cout << xs[i] << " ^ (-1) mod 12 = " << inverses.inverses[i] << endl;
+    }
+    cout << "no inverse at the indices";
+    for (size_t i = 0; i < inverses.notInvertible.size(); i++) {
+        cout << " " << inverses.notInvertible[i];
+    }
+    cout << endl;
+    cout << "### Step 9 done ###" << endl;
+    cin.get();
+
+    // Step 10
+    cout << "##### Step 10 ### testBatchModularInverse #####" << endl;
+    testBatchModularInverse();
+    cout << "### Step 10 done ###" << endl;
+    cin.get();
+
     return 0;
 }
@@ -19,9 +19,25 @@ plot 'gcdNaive.data' using 1:2 title 'Naive' with linespoints
 # EUCLID ONLY:
 #plot 'gcdEuclid.data' using 1:2 title 'Euclid' with linespoints
 
+# BINARY ONLY:
+#plot 'gcdBinary.data' using 1:2 title 'Binary' with linespoints
+
+# EUCLID AND BINARY:
+#plot 'gcdEuclid.data' using 1:2 title 'Euclid' with linespoints, 'gcdBinary.data' using 1:2 title 'Binary' with linespoints
+
+# EUCLID, BINARY AND LEHMER:
+#plot 'gcdEuclid.data' using 1:2 title 'Euclid' with linespoints, 'gcdBinary.data' using 1:2 title 'Binary' with linespoints, 'gcdLehmer.data' using 1:2 title 'Lehmer' with linespoints
+
 # EXTENDED ONLY:
 #plot 'gcdExtended.data' using 1:2 title 'Extended Euclid' with linespoints
 
+# EXTENDED AND EXTENDED LEHMER:
+#plot 'gcdExtended.data' using 1:2 title 'Extended Euclid' with linespoints, 'gcdExtendedLehmer.data' using 1:2 title 'Extended Lehmer' with linespoints
+
+# EXTENDED BY THE HALF-GCD (time and the time of one multiplication times log n, both in log scale):
+#set logscale xy
+#plot 'gcdExtendedHalf.data' using 1:2 title 'Extended half-GCD' with linespoints, 'gcdExtendedHalf.data' using 1:($3*log($1)/log(2)) title 'M(n) log n' with linespoints
+
 # EUCLID AND EXTENDED:
 #plot 'gcdEuclid.data' using 1:2 title 'Euclid' with linespoints, 'gcdExtended.data' using 1:2 title 'Extended Euclid' with linespoints
 